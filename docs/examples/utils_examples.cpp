@@ -150,8 +150,84 @@ static void cell_extracted_optcell(envw env) {
 #endif
 //! [Cell Extracted]
 
+//! [Typed Functions]
+static int add_ints(int x, int y) { return x + y; }
+
+static void typed_function_examples(envw env) {
+  // (fn X Y)
+  env->*make_typed_function("Add X and Y.\n\n(fn X Y)", &add_ints);
+
+  // (fn S &rest REST), the environment is passed if the first parameter is envw
+  env->*make_typed_function(
+    "Return S and the number of REST as a string.\n\n(fn S &rest REST)",
+    [](envw env, std::string s, spreader_restargs rest) {
+      return s + std::to_string(rest.size());
+    });
+
+#if defined(__cpp_lib_optional) || (__cplusplus > 201606L)
+  // (fn X &optional Y), returning nil
+  env->*make_typed_function(
+    "Do something with X and maybe Y.\n\n(fn X &optional Y)",
+    [](envw env, int x, std::optional<double> y) {
+      if (y) {
+        // invoked with non-nil Y
+      }
+    });
+#endif
+}
+//! [Typed Functions]
+
+#ifdef CPPEMACS_HAVE_KEYWORD_ARGS
+//! [Keyword Arguments]
+static void keyword_args_examples(envw env) {
+  env->*make_typed_function(
+    "Search for NEEDLE, up to LIMIT, ignoring case if CASE-FOLD.\n\n"
+    "(fn NEEDLE &key LIMIT CASE-FOLD)",
+    [](envw env, std::string needle, keyword_args<"limit", "case-fold"> kws) {
+      intmax_t limit = kws.get<"limit">(intmax_t(-1));
+      bool case_fold = kws.get<"case-fold">(false);
+      // ...
+      return nullptr;
+    });
+}
+//! [Keyword Arguments]
+#endif
+
+//! [Function Manifests]
+static void function_manifest_examples(envw env) {
+  define_functions(env, make_function_manifest(
+    defun("cppemacs-example-add", make_spreader_function(
+      spreader_arity<2>(), "Add X and Y.\n\n(fn X Y)",
+      [](envw env, intcell x, intcell y) -> int {
+        return x.get() + y.get();
+      })),
+    defun("cppemacs-example-ignore", make_spreader_function(
+      spreader_variadic<0>(), "Ignore all arguments.\n\n(fn &rest _)",
+      [](envw env, spreader_restargs) {
+        return nullptr;
+      })),
+    // the real function is only created on the first call
+    lazy_defun("cppemacs-example-rarely-used", 0, 0,
+      "Do something expensive.\n\n(fn)",
+      []() {
+        std::vector<int> big_table(1 << 20);
+        return make_spreader_function(
+          spreader_thunk(), "Do something expensive.\n\n(fn)",
+          [big_table](envw env) -> intmax_t {
+            return big_table.size();
+          });
+      })
+  ));
+}
+//! [Function Manifests]
+
 static void module_init(envw env) {
   cell_extracted_examples(env);
+  typed_function_examples(env);
+#ifdef CPPEMACS_HAVE_KEYWORD_ARGS
+  keyword_args_examples(env);
+#endif
+  function_manifest_examples(env);
 #if defined(__cpp_lib_optional) || (__cplusplus > 201606L)
   cell_extracted_optcell(env);
 #endif
@@ -59,9 +59,12 @@
  * @{
  */
 
+#include <algorithm>
+#include <memory>
+#include <ostream>
+#include <vector>
 #if CPPEMACS_ENABLE_GMPXX
 #  include <gmpxx.h>
-#  include <memory>
 #endif
 
 namespace cppemacs {
@@ -85,6 +88,13 @@ static constexpr ptrdiff_t uintmax_limb_count =
 static_assert(CPPEMACS_UINTMAX_ONE_LIMB == (detail::uintmax_limb_count == 1), "Inconsistent limb size detection");
 #endif
 
+#if defined(__SIZEOF_INT128__) || defined(CPPEMACS_DOXYGEN_RUNNING)
+#define CPPEMACS_HAVE_INT128 1
+// __extension__ keeps -Wpedantic quiet, so use these instead of naming the types directly
+__extension__ typedef __int128 int128;
+__extension__ typedef unsigned __int128 uint128;
+#endif
+
 }
 
 /**
@@ -110,11 +120,15 @@ inline value to_emacs(expected_type_t<std::nullptr_t>, envw nv, std::nullptr_t)
 inline value to_emacs(expected_type_t<bool>, envw nv, bool x) { return nv.intern(x ? "t" : "nil"); }
 /** @brief Convert x to bool, true if non-nil. */
 inline bool from_emacs(expected_type_t<bool>, envw nv, value x) { return nv.is_not_nil(x); }
+/** @brief Convert x to bool, true if non-nil. This always succeeds. */
+inline bool try_from_emacs(expected_type_t<bool>, envw nv, value x, bool &out, conversion_exit) noexcept
+{ out = nv.is_not_nil(x); return true; }
 
 /** @brief Convert a C++ integer to an Emacs integer.
  *
  * This only works with integral types that are no larger than
- * `intmax_t`. From Emacs 27, `uintmax_t` is also supported via
+ * `intmax_t`. From Emacs 27, `uintmax_t`, and `__int128` and `unsigned
+ * __int128` where the compiler has them, are also supported via
  * biginteger conversions.
  */
 template <typename Int, detail::enable_if_t<detail::is_integral_smaller_than_intmax<Int>::value, bool> = true>
@@ -147,8 +161,8 @@ inline value to_emacs(expected_type_t<uintmax_t>, envw nv, uintmax_t n) {
 
 namespace detail {
 template <typename Int>
-[[noreturn]] inline void throw_out_of_range(envw nv, value val) {
-  throw signalled(
+inline signalled out_of_range_signal(envw nv, value val) noexcept {
+  return signalled(
     (nv->*"args-out-of-range"),
     nv.funcall(nv->*"list", {
         val,
@@ -156,12 +170,32 @@ template <typename Int>
         nv->*std::numeric_limits<Int>::max()
       }));
 }
+template <typename Int>
+[[noreturn]] inline void throw_out_of_range(envw nv, value val) {
+  throw out_of_range_signal<Int>(nv, val);
+}
+// only build the signal data if it is going to be kept
+template <typename Int>
+inline bool fail_out_of_range(envw nv, value val, conversion_exit ex) noexcept {
+  if (ex == conversion_exit::keep) {
+    signalled sig = out_of_range_signal<Int>(nv, val);
+    nv.non_local_exit_signal(sig.symbol, sig.data);
+  }
+  return false;
+}
+template <size_t MajorVersion>
+inline bool try_assert_compatible(envw nv) noexcept {
+  if (nv.is_compatible<MajorVersion>()) return true;
+  nv.run_catching([]() { envw::version_check_error<MajorVersion>(); });
+  return false;
+}
 }
 
 /** @brief Convert an Emacs integer to a C++ integer.
  *
  * This only works with integral types that are no larger than
- * `intmax_t`. From Emacs 27, `uintmax_t` is also supported via
+ * `intmax_t`. From Emacs 27, `uintmax_t`, and `__int128` and `unsigned
+ * __int128` where the compiler has them, are also supported via
  * biginteger conversions.
  */
 template <typename Int, detail::enable_if_t<detail::is_integral_smaller_than_intmax<Int>::value, bool> = true>
@@ -174,21 +208,32 @@ inline Int from_emacs(expected_type_t<Int>, envw nv, value val) {
   }
   return static_cast<Int>(int_val);
 }
+/** @brief Try to convert an Emacs integer to a C++ integer.
+ * @see envw::try_extract() */
+template <typename Int, detail::enable_if_t<detail::is_integral_smaller_than_intmax<Int>::value, bool> = true>
+inline bool try_from_emacs(expected_type_t<Int>, envw nv, value val, Int &out, conversion_exit ex) noexcept {
+  intmax_t int_val = nv.extract_integer(val);
+  if (nv.non_local_exit_check()) return false;
+  if (int_val < static_cast<intmax_t>(std::numeric_limits<Int>::min())
+      || int_val > static_cast<intmax_t>(std::numeric_limits<Int>::max())) {
+    return detail::fail_out_of_range<Int>(nv, val, ex);
+  }
+  out = static_cast<Int>(int_val);
+  return true;
+}
 
 #if (EMACS_MAJOR_VERSION >= 27)
 
-/** @brief Convert an Emacs integer to a C++ `uintmax_t`. Emacs 27+ only. */
-inline uintmax_t from_emacs(expected_type_t<uintmax_t>, envw nv, value val) {
-  nv.assert_compatible<27>();
-  using namespace detail;
+namespace detail {
+// false with a pending non-local exit if Emacs failed, or without if out of range
+inline bool extract_uintmax(envw nv, value val, uintmax_t &out) noexcept {
   // always use bigint conversion
   int sign = 0;
   ptrdiff_t count = uintmax_limb_count;
   emacs_limb_t magnitude[uintmax_limb_count] = {0};
   if (!nv.extract_big_integer(val, &sign, &count, magnitude)
       || sign < 0) {
-    nv.maybe_non_local_exit();
-    detail::throw_out_of_range<uintmax_t>(nv, val);
+    return false;
   }
   constexpr size_t extra_digits =
     std::numeric_limits<uintmax_t>::digits
@@ -200,15 +245,151 @@ inline uintmax_t from_emacs(expected_type_t<uintmax_t>, envw nv, value val) {
                 "UINTMAX_DIGITS must be a multiple of EMACS_LIMB_DIGITS\n"
                 "Please tell me what platform you are using!");
 #if CPPEMACS_UINTMAX_ONE_LIMB
-  return static_cast<uintmax_t>(magnitude[0]);
+  out = static_cast<uintmax_t>(magnitude[0]);
 #else
   uintmax_t ret = 0;
   for (int ii = uintmax_limb_count - 1; ii >= 0; --ii) {
     ret <<= std::numeric_limits<emacs_limb_t>::digits;
     ret |= static_cast<uintmax_t>(magnitude[ii]);
   }
+  out = ret;
+#endif
+  return true;
+}
+}
+
+/** @brief Convert an Emacs integer to a C++ `uintmax_t`. Emacs 27+ only. */
+inline uintmax_t from_emacs(expected_type_t<uintmax_t>, envw nv, value val) {
+  nv.assert_compatible<27>();
+  uintmax_t ret = 0;
+  if (!detail::extract_uintmax(nv, val, ret)) {
+    nv.maybe_non_local_exit();
+    detail::throw_out_of_range<uintmax_t>(nv, val);
+  }
   return ret;
+}
+
+/** @brief Try to convert an Emacs integer to a C++ `uintmax_t`. Emacs 27+ only.
+ * @see envw::try_extract() */
+inline bool try_from_emacs(expected_type_t<uintmax_t>, envw nv, value val, uintmax_t &out, conversion_exit ex) noexcept {
+  if (!detail::try_assert_compatible<27>(nv)) return false;
+  if (detail::extract_uintmax(nv, val, out)) return true;
+  return nv.non_local_exit_check() ? false : detail::fail_out_of_range<uintmax_t>(nv, val, ex);
+}
 #endif
+
+#if (EMACS_MAJOR_VERSION >= 27) && defined(CPPEMACS_HAVE_INT128)
+
+namespace detail {
+/** @brief number of `emacs_limb_t`s required to represent a `uint128` */
+static constexpr ptrdiff_t uint128_limb_count = 128 / std::numeric_limits<emacs_limb_t>::digits;
+static_assert(128 % std::numeric_limits<emacs_limb_t>::digits == 0,
+              "128 must be a multiple of EMACS_LIMB_DIGITS");
+
+inline value make_int128(envw nv, int sign, uint128 mag) {
+  nv.assert_compatible<27>();
+  emacs_limb_t magnitude[uint128_limb_count];
+  for (ptrdiff_t ii = 0; ii < uint128_limb_count;
+       ++ii, mag >>= std::numeric_limits<emacs_limb_t>::digits) {
+    magnitude[ii] = static_cast<emacs_limb_t>(mag);
+  }
+  return nv.make_big_integer(sign, uint128_limb_count, magnitude);
+}
+
+// false with a pending non-local exit if Emacs failed (including if too big)
+inline bool extract_int128(envw nv, value val, int &sign, uint128 &mag) noexcept {
+  ptrdiff_t count = uint128_limb_count;
+  emacs_limb_t magnitude[uint128_limb_count] = {0};
+  if (!nv.extract_big_integer(val, &sign, &count, magnitude)) return false;
+  mag = 0;
+  for (ptrdiff_t ii = count; ii-- > 0;) {
+    mag <<= std::numeric_limits<emacs_limb_t>::digits;
+    mag |= magnitude[ii];
+  }
+  return true;
+}
+
+// false if out of range
+inline bool int128_from_magnitude(int sign, uint128 mag, int128 &out) noexcept {
+  constexpr uint128 max_mag = static_cast<uint128>(std::numeric_limits<int128>::max());
+  if (sign < 0) {
+    if (mag > max_mag + 1) return false;
+    // avoid converting 2^127 itself
+    out = -static_cast<int128>(mag - 1) - 1;
+  } else {
+    if (mag > max_mag) return false;
+    out = static_cast<int128>(mag);
+  }
+  return true;
+}
+}
+
+/** @brief Convert a C++ `__int128` to an Emacs integer.
+ *
+ * This only needs Emacs 27+ if the value does not fit in `intmax_t`.
+ */
+inline value to_emacs(expected_type_t<detail::int128>, envw nv, detail::int128 n) {
+  if (n >= std::numeric_limits<intmax_t>::min() && n <= std::numeric_limits<intmax_t>::max()) {
+    return nv.make_integer(static_cast<intmax_t>(n));
+  }
+  return n < 0
+    ? detail::make_int128(nv, -1, detail::uint128(0) - static_cast<detail::uint128>(n))
+    : detail::make_int128(nv, 1, static_cast<detail::uint128>(n));
+}
+
+/** @brief Convert a C++ `unsigned __int128` to an Emacs integer.
+ *
+ * This only needs Emacs 27+ if the value does not fit in `intmax_t`.
+ */
+inline value to_emacs(expected_type_t<detail::uint128>, envw nv, detail::uint128 n) {
+  if (n <= static_cast<uintmax_t>(std::numeric_limits<intmax_t>::max())) {
+    return nv.make_integer(static_cast<intmax_t>(n));
+  }
+  return detail::make_int128(nv, 1, n);
+}
+
+/** @brief Convert an Emacs integer to a C++ `__int128`. Emacs 27+ only. */
+inline detail::int128 from_emacs(expected_type_t<detail::int128>, envw nv, value val) {
+  nv.assert_compatible<27>();
+  int sign = 0;
+  detail::uint128 mag = 0;
+  detail::int128 ret = 0;
+  if (!detail::extract_int128(nv, val, sign, mag)) nv.maybe_non_local_exit();
+  if (!detail::int128_from_magnitude(sign, mag, ret)) detail::throw_out_of_range<detail::int128>(nv, val);
+  return ret;
+}
+
+/** @brief Try to convert an Emacs integer to a C++ `__int128`. Emacs 27+ only.
+ * @see envw::try_extract() */
+inline bool try_from_emacs(expected_type_t<detail::int128>, envw nv, value val, detail::int128 &out, conversion_exit ex) noexcept {
+  if (!detail::try_assert_compatible<27>(nv)) return false;
+  int sign = 0;
+  detail::uint128 mag = 0;
+  if (!detail::extract_int128(nv, val, sign, mag)) return false;
+  return detail::int128_from_magnitude(sign, mag, out)
+    || detail::fail_out_of_range<detail::int128>(nv, val, ex);
+}
+
+/** @brief Convert an Emacs integer to a C++ `unsigned __int128`. Emacs 27+ only. */
+inline detail::uint128 from_emacs(expected_type_t<detail::uint128>, envw nv, value val) {
+  nv.assert_compatible<27>();
+  int sign = 0;
+  detail::uint128 ret = 0;
+  if (!detail::extract_int128(nv, val, sign, ret)) nv.maybe_non_local_exit();
+  if (sign < 0) detail::throw_out_of_range<detail::uint128>(nv, val);
+  return ret;
+}
+
+/** @brief Try to convert an Emacs integer to a C++ `unsigned __int128`. Emacs 27+ only.
+ * @see envw::try_extract() */
+inline bool try_from_emacs(expected_type_t<detail::uint128>, envw nv, value val, detail::uint128 &out, conversion_exit ex) noexcept {
+  if (!detail::try_assert_compatible<27>(nv)) return false;
+  int sign = 0;
+  detail::uint128 mag = 0;
+  if (!detail::extract_int128(nv, val, sign, mag)) return false;
+  if (sign < 0) return detail::fail_out_of_range<detail::uint128>(nv, val, ex);
+  out = mag;
+  return true;
 }
 #endif
 
@@ -227,6 +408,15 @@ inline value to_emacs(expected_type_t<Float>, envw nv, Float d)
 template <typename Float, detail::enable_if_t<std::is_floating_point<Float>::value, bool> = true>
 inline Float from_emacs(expected_type_t<Float>, envw nv, value val)
 { return static_cast<Float>(nv.extract_float(val)); }
+/** @brief Try to convert an Emacs float to a C++ float.
+ * @see envw::try_extract() */
+template <typename Float, detail::enable_if_t<std::is_floating_point<Float>::value, bool> = true>
+inline bool try_from_emacs(expected_type_t<Float>, envw nv, value val, Float &out, conversion_exit) noexcept {
+  double d = nv.extract_float(val);
+  if (nv.non_local_exit_check()) return false;
+  out = static_cast<Float>(d);
+  return true;
+}
 
 #if (EMACS_MAJOR_VERSION >= 27)
 /** @brief Convert a C timespec to an Emacs timespec. Emacs 27+ only. */
@@ -235,6 +425,311 @@ inline value to_emacs(expected_type_t<struct timespec>, envw nv, struct timespec
 /** @brief Convert a C timespec to an Emacs timespec. Emacs 27+ only. */
 inline struct timespec from_emacs(expected_type_t<struct timespec>, envw nv, value val)
 { nv.assert_compatible<27>(); return nv.extract_time(val); }
+/** @brief Try to convert an Emacs time to a C timespec. Emacs 27+ only. */
+inline bool try_from_emacs(expected_type_t<struct timespec>, envw nv, value val, struct timespec &out, conversion_exit) noexcept {
+  if (!detail::try_assert_compatible<27>(nv)) return false;
+  struct timespec time = nv.extract_time(val);
+  if (nv.non_local_exit_check()) return false;
+  out = time;
+  return true;
+}
+#endif
+
+#if (EMACS_MAJOR_VERSION >= 27)
+namespace detail {
+/** @brief The number of limbs big integer conversions keep on the stack. */
+static constexpr size_t inline_limb_count = 8;
+
+/** @brief Limbs for a big integer conversion, on the stack unless there are too many. */
+struct limb_buffer {
+  emacs_limb_t local[inline_limb_count];
+  std::unique_ptr<emacs_limb_t[]> heap;
+
+  /** @brief Get space for `count` limbs, invalidating any previous space. */
+  emacs_limb_t *get(size_t count) {
+    if (count <= inline_limb_count) return local;
+    heap.reset(new emacs_limb_t[count]);
+    return heap.get();
+  }
+};
+
+/**
+ * @brief Extract the magnitude of `x` into `buf`, trying the stack first.
+ *
+ * @return The limbs, or null if `x` is not an integer, in which case the
+ * non-local exit is left pending.
+ */
+inline emacs_limb_t *extract_limbs(envw nv, value x, limb_buffer &buf, int &sign, ptrdiff_t &count) {
+  count = inline_limb_count;
+  if (nv.extract_big_integer(x, &sign, &count, buf.local)) return buf.local;
+  // too small, count now holds the size needed
+  if (count <= ptrdiff_t(inline_limb_count)) return nullptr;
+  nv.non_local_exit_clear();
+  emacs_limb_t *magnitude = buf.get(size_t(count));
+  return nv.extract_big_integer(x, &sign, &count, magnitude) ? magnitude : nullptr;
+}
+}
+
+namespace detail {
+using limb_vector = std::vector<emacs_limb_t>;
+static constexpr int limb_digits = std::numeric_limits<emacs_limb_t>::digits;
+
+inline void trim_limbs(limb_vector &mag) noexcept {
+  while (!mag.empty() && !mag.back()) mag.pop_back();
+}
+
+inline int compare_limbs(const limb_vector &a, const limb_vector &b) noexcept {
+  if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+  for (size_t ii = a.size(); ii-- > 0;) {
+    if (a[ii] != b[ii]) return a[ii] < b[ii] ? -1 : 1;
+  }
+  return 0;
+}
+
+inline limb_vector add_limbs(const limb_vector &a, const limb_vector &b) {
+  const limb_vector &big = a.size() < b.size() ? b : a, &small = a.size() < b.size() ? a : b;
+  limb_vector ret(big.size() + 1);
+  emacs_limb_t carry = 0;
+  for (size_t ii = 0; ii < big.size(); ++ii) {
+    emacs_limb_t sum = big[ii] + carry;
+    carry = sum < carry;
+    if (ii < small.size()) {
+      sum += small[ii];
+      carry += sum < small[ii];
+    }
+    ret[ii] = sum;
+  }
+  ret.back() = carry;
+  trim_limbs(ret);
+  return ret;
+}
+
+// requires a >= b
+inline limb_vector sub_limbs(const limb_vector &a, const limb_vector &b) {
+  limb_vector ret(a.size());
+  emacs_limb_t borrow = 0;
+  for (size_t ii = 0; ii < a.size(); ++ii) {
+    emacs_limb_t rhs = ii < b.size() ? b[ii] : 0;
+    emacs_limb_t diff = a[ii] - rhs - borrow;
+    borrow = (a[ii] < rhs) || (a[ii] - rhs < borrow);
+    ret[ii] = diff;
+  }
+  trim_limbs(ret);
+  return ret;
+}
+
+// the low limb of a * b, with the high limb in hi
+inline emacs_limb_t mul_limb(emacs_limb_t a, emacs_limb_t b, emacs_limb_t &hi) noexcept {
+  constexpr int half = limb_digits / 2;
+  constexpr emacs_limb_t mask = (emacs_limb_t(1) << half) - 1;
+  emacs_limb_t a0 = a & mask, a1 = a >> half, b0 = b & mask, b1 = b >> half;
+  emacs_limb_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+  emacs_limb_t mid = (p00 >> half) + (p01 & mask) + (p10 & mask);
+  hi = p11 + (p01 >> half) + (p10 >> half) + (mid >> half);
+  return (mid << half) | (p00 & mask);
+}
+
+inline limb_vector mul_limbs(const limb_vector &a, const limb_vector &b) {
+  if (a.empty() || b.empty()) return limb_vector();
+  limb_vector ret(a.size() + b.size());
+  for (size_t ii = 0; ii < a.size(); ++ii) {
+    emacs_limb_t carry = 0;
+    for (size_t jj = 0; jj < b.size(); ++jj) {
+      emacs_limb_t hi, lo = mul_limb(a[ii], b[jj], hi);
+      // a * b + ret + carry always fits in two limbs
+      emacs_limb_t sum = ret[ii + jj] + lo;
+      hi += sum < lo;
+      sum += carry;
+      hi += sum < carry;
+      ret[ii + jj] = sum;
+      carry = hi;
+    }
+    ret[ii + b.size()] = carry;
+  }
+  trim_limbs(ret);
+  return ret;
+}
+
+// divide mag by divisor in place, which must be below 2^(limb_digits / 2), returning the remainder
+inline emacs_limb_t divmod_limbs(limb_vector &mag, emacs_limb_t divisor) noexcept {
+  constexpr int half = limb_digits / 2;
+  constexpr emacs_limb_t mask = (emacs_limb_t(1) << half) - 1;
+  emacs_limb_t rem = 0;
+  for (size_t ii = mag.size(); ii-- > 0;) {
+    emacs_limb_t hi = (rem << half) | (mag[ii] >> half);
+    emacs_limb_t qhi = hi / divisor;
+    rem = hi % divisor;
+    emacs_limb_t lo = (rem << half) | (mag[ii] & mask);
+    emacs_limb_t qlo = lo / divisor;
+    rem = lo % divisor;
+    mag[ii] = (qhi << half) | qlo;
+  }
+  trim_limbs(mag);
+  return rem;
+}
+}
+
+/**
+ * @brief An arbitrary-precision integer, which converts directly to and from
+ * Emacs integers without GMP. Emacs 27+ only.
+ *
+ * This is a sign and a magnitude of @ref emacs_limb_t "limbs", least
+ * significant first, with no high zero limbs. It supports comparison,
+ * addition, subtraction and multiplication, which is enough for passing
+ * values like 256-bit keys around. For anything more, use `mpz_class` with
+ * @ref CPPEMACS_ENABLE_GMPXX.
+ *
+ * @code{.cpp}
+ * big_integer key = env.extract<big_integer>(arg);
+ * const std::vector<emacs_limb_t> &limbs = key.magnitude();
+ * return env->*(key * 2 + 1);
+ * @endcode
+ */
+class big_integer {
+public:
+  /** @brief Zero. */
+  big_integer() noexcept : sgn(0) {}
+
+  /** @brief Convert from a C++ integer. */
+  template <typename Int, detail::enable_if_t<
+              std::is_integral<Int>::value &&
+              (std::numeric_limits<Int>::digits <= std::numeric_limits<uintmax_t>::digits), bool> = true>
+  big_integer(Int n) : sgn(n < 0 ? -1 : n > 0 ? 1 : 0) {
+    uintmax_t mag = n < 0 ? uintmax_t(0) - uintmax_t(n) : uintmax_t(n);
+#if CPPEMACS_UINTMAX_ONE_LIMB
+    if (mag) limbs.push_back(static_cast<emacs_limb_t>(mag));
+#else
+    for (; mag; mag >>= detail::limb_digits) {
+      limbs.push_back(static_cast<emacs_limb_t>(mag & std::numeric_limits<emacs_limb_t>::max()));
+    }
+#endif
+  }
+
+  /**
+   * @brief Construct from a sign and a magnitude, least significant limb
+   * first. Only the sign of `sign` is used.
+   */
+  big_integer(int sign, std::vector<emacs_limb_t> magnitude) noexcept
+    : sgn(sign < 0 ? -1 : sign > 0 ? 1 : 0), limbs(std::move(magnitude)) {
+    normalize();
+  }
+
+  /** @brief Get the sign, -1, 0 or 1. */
+  int sign() const noexcept { return sgn; }
+  /** @brief Get the magnitude, least significant limb first, and empty if zero. */
+  const std::vector<emacs_limb_t> &magnitude() const noexcept { return limbs; }
+
+  /** @brief Format in decimal. */
+  std::string to_string() const {
+    if (!sgn) return "0";
+    // peel off as many decimal digits at a time as fit in half a limb
+    emacs_limb_t chunk = 10;
+    int chunk_digits = 1;
+    while (chunk * 10 < (emacs_limb_t(1) << (detail::limb_digits / 2))) {
+      chunk *= 10;
+      ++chunk_digits;
+    }
+    std::vector<emacs_limb_t> mag = limbs;
+    std::string ret;
+    while (!mag.empty()) {
+      emacs_limb_t rem = detail::divmod_limbs(mag, chunk);
+      for (int ii = 0; ii < chunk_digits && (rem || !mag.empty()); ++ii, rem /= 10) {
+        ret.push_back(char('0' + rem % 10));
+      }
+    }
+    if (sgn < 0) ret.push_back('-');
+    std::reverse(ret.begin(), ret.end());
+    return ret;
+  }
+
+  friend std::ostream &operator<<(std::ostream &os, const big_integer &n) { return os << n.to_string(); }
+
+  friend bool operator==(const big_integer &a, const big_integer &b) noexcept
+  { return a.sgn == b.sgn && a.limbs == b.limbs; }
+  friend bool operator!=(const big_integer &a, const big_integer &b) noexcept { return !(a == b); }
+  friend bool operator<(const big_integer &a, const big_integer &b) noexcept {
+    if (a.sgn != b.sgn) return a.sgn < b.sgn;
+    int cmp = detail::compare_limbs(a.limbs, b.limbs);
+    return a.sgn < 0 ? cmp > 0 : cmp < 0;
+  }
+  friend bool operator>(const big_integer &a, const big_integer &b) noexcept { return b < a; }
+  friend bool operator<=(const big_integer &a, const big_integer &b) noexcept { return !(b < a); }
+  friend bool operator>=(const big_integer &a, const big_integer &b) noexcept { return !(a < b); }
+
+  friend big_integer operator-(big_integer a) noexcept {
+    a.sgn = -a.sgn;
+    return a;
+  }
+  friend big_integer operator+(const big_integer &a, const big_integer &b) {
+    if (!a.sgn) return b;
+    if (!b.sgn) return a;
+    if (a.sgn == b.sgn) return big_integer(a.sgn, detail::add_limbs(a.limbs, b.limbs));
+    int cmp = detail::compare_limbs(a.limbs, b.limbs);
+    if (cmp == 0) return big_integer();
+    return cmp > 0
+      ? big_integer(a.sgn, detail::sub_limbs(a.limbs, b.limbs))
+      : big_integer(b.sgn, detail::sub_limbs(b.limbs, a.limbs));
+  }
+  friend big_integer operator-(const big_integer &a, const big_integer &b) { return a + -b; }
+  friend big_integer operator*(const big_integer &a, const big_integer &b) {
+    return big_integer(a.sgn * b.sgn, detail::mul_limbs(a.limbs, b.limbs));
+  }
+  big_integer &operator+=(const big_integer &o) { return *this = *this + o; }
+  big_integer &operator-=(const big_integer &o) { return *this = *this - o; }
+  big_integer &operator*=(const big_integer &o) { return *this = *this * o; }
+
+  /** @brief Convert to an Emacs integer. */
+  friend value to_emacs(expected_type_t<big_integer>, envw nv, const big_integer &n) {
+    nv.assert_compatible<27>();
+    nv.maybe_non_local_exit();
+    return nv.make_big_integer(n.sgn, ptrdiff_t(n.limbs.size()), n.limbs.data());
+  }
+
+  /** @brief Convert from an Emacs integer. */
+  friend big_integer from_emacs(expected_type_t<big_integer>, envw nv, value x) {
+    nv.assert_compatible<27>();
+    big_integer ret;
+    if (!ret.extract(nv, x)) {
+      nv.maybe_non_local_exit();
+      throw std::runtime_error("Bigint conversion failed");
+    }
+    return ret;
+  }
+
+  /** @brief Try to convert from an Emacs integer. @see envw::try_extract() */
+  friend bool try_from_emacs(expected_type_t<big_integer>, envw nv, value x, big_integer &out, conversion_exit ex) noexcept {
+    if (!detail::try_assert_compatible<27>(nv)) return false;
+    try {
+      if (out.extract(nv, x)) return true;
+    } catch (const std::bad_alloc &) {}
+    if (ex == conversion_exit::clear) nv.non_local_exit_clear();
+    return false;
+  }
+
+private:
+  int sgn;
+  std::vector<emacs_limb_t> limbs;
+
+  void normalize() noexcept {
+    detail::trim_limbs(limbs);
+    if (limbs.empty()) sgn = 0;
+    else if (!sgn) limbs.clear();
+  }
+
+  // false with a pending non-local exit on failure, leaving *this untouched
+  bool extract(envw nv, value x) {
+    detail::limb_buffer buf;
+    int sign = 0;
+    ptrdiff_t count = 0;
+    emacs_limb_t *magnitude = detail::extract_limbs(nv, x, buf, sign, count);
+    if (!magnitude) return false;
+    std::vector<emacs_limb_t> mag(magnitude, magnitude + count);
+    sgn = sign;
+    limbs = std::move(mag);
+    normalize();
+    return true;
+  }
+};
 #endif
 
 #if ((EMACS_MAJOR_VERSION >= 27) && CPPEMACS_ENABLE_GMPXX) || defined(CPPEMACS_DOXYGEN_RUNNING)
@@ -256,14 +751,15 @@ inline value to_emacs(expected_type_t<mpz_class>, envw nv, const mpz_class &zc)
   int sign = mpz_sgn(z);
   size_t count = 0;
   size_t nwords = 1 + (mpz_sizeinbase(z, 2) - 1) / std::numeric_limits<emacs_limb_t>::digits;
-  std::unique_ptr<emacs_limb_t[]> magnitude(new emacs_limb_t[nwords]);
+  detail::limb_buffer buf;
+  emacs_limb_t *magnitude = buf.get(nwords);
   mpz_export(
-    magnitude.get(), &count,
+    magnitude, &count,
     -1, sizeof(emacs_limb_t), 0, 0, // LE limbs, native byte order, full words
     z
   );
 
-  return nv.make_big_integer(sign, count, magnitude.get());
+  return nv.make_big_integer(sign, count, magnitude);
 }
 
 /**
@@ -276,28 +772,26 @@ inline mpz_class from_emacs(expected_type_t<mpz_class>, envw nv, value x) {
 
   int sign = 0;
   ptrdiff_t count = 0;
-  if (nv.extract_big_integer(x, &sign, &count, nullptr)) {
+  detail::limb_buffer buf;
+  if (emacs_limb_t *magnitude = detail::extract_limbs(nv, x, buf, sign, count)) {
     if (sign == 0) {
       return 0;
     }
 
-    std::unique_ptr<emacs_limb_t[]> magnitude(new emacs_limb_t[count]);
-    if (nv.extract_big_integer(x, &sign, &count, magnitude.get())) {
-      mpz_class ret;
-
-      mpz_ptr z = ret.get_mpz_t();
-      mpz_import(
-        z, count,
-        -1, sizeof(emacs_limb_t), 0, 0, // LE limbs, native byte order, full words
-        magnitude.get()
-      );
+    mpz_class ret;
 
-      if (sign == -1) {
-        mpz_neg(z, z);
-      }
+    mpz_ptr z = ret.get_mpz_t();
+    mpz_import(
+      z, count,
+      -1, sizeof(emacs_limb_t), 0, 0, // LE limbs, native byte order, full words
+      magnitude
+    );
 
-      return ret;
+    if (sign == -1) {
+      mpz_neg(z, z);
     }
+
+    return ret;
   }
 
   nv.maybe_non_local_exit();
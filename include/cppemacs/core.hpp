@@ -97,6 +97,7 @@
 #  undef emacs_module_init
 #endif
 
+#include <atomic>
 #include <cassert>
 #include <exception>
 #include <initializer_list>
@@ -104,7 +105,18 @@
 #include <utility>
 #include <type_traits>
 #include <string>
+#include <typeindex>
 #include <typeinfo>
+#include <unordered_map>
+#if CPPEMACS_ENABLE_CHECKED_ENV
+#  include <cstdio>
+#  include <cstdlib>
+#  include <thread>
+#  include <vector>
+#endif
+#ifdef CPPEMACS_HAVE_CXX17
+#include <optional>
+#endif
 
 /**
  * @page GFDL-1.3-or-later GNU Free Documentation License
@@ -279,7 +291,8 @@ namespace cppemacs {}
  * - @ref cppemacs::envw::run_catching() "envw::run_catching()" stores C++
  *   exceptions as `user-ptr`s of `std::exception_ptr`s, and @ref
  *   cppemacs::envw::rethrow_non_local_exit() "envw::rethrow_non_local_exit()"
- *   unboxes them.
+ *   unboxes them. The error used to box them is defined once per module,
+ *   see @ref cppemacs::register_exception_boxing().
  *
  * @see CPPEMACS_DEFAULT_EXCEPTION_BOXER for more fine-grained control
  * over the default `Boxing` parameter.
@@ -287,6 +300,22 @@ namespace cppemacs {}
 #  define CPPEMACS_ENABLE_EXCEPTION_BOXING 0
 #endif
 
+#ifndef CPPEMACS_ENABLE_CHECKED_ENV
+/**
+ * @brief Define as 1 before including <@ref cppemacs/core.hpp> to check every
+ * use of an @ref cppemacs::envw "envw", at the cost of performance.
+ *
+ * Each `envw` then records the thread it was made on, and the module call it
+ * was made in, see @ref cppemacs::env_call_scope. Using it through
+ * `operator->`, its methods, or its conversion to a raw `emacs_env *` (which
+ * @ref cppemacs_conversions "conversions" may use) on another thread, or
+ * after that call has returned, prints a message to `stderr` and aborts.
+ *
+ * When this is 0, `envw` is just the raw pointer.
+ */
+#  define CPPEMACS_ENABLE_CHECKED_ENV 0
+#endif
+
 /**@}*/
 /**
  * @addtogroup cppemacs_core
@@ -353,7 +382,7 @@ template <size_t N, typename> struct index_sequence_snoc;
 template <size_t N, size_t...Idx> struct index_sequence_snoc<N, index_sequence<Idx...>>
 { using type = index_sequence<Idx..., N>; };
 template <size_t N> struct make_index_sequence_ :
-    index_sequence_snoc<N, typename make_index_sequence_<N - 1>::type> {};
+    index_sequence_snoc<N - 1, typename make_index_sequence_<N - 1>::type> {};
 template <> struct make_index_sequence_<0> { using type = index_sequence<>; };
 
 template <size_t N> using make_index_sequence = typename make_index_sequence_<N>::type;
@@ -472,6 +501,10 @@ static constexpr ptrdiff_t emacs_variadic_function = ::emacs_variadic_function;
 #define CPPEMACS_HAVE_STRING_VIEW 1
 #endif
 
+#if (defined(__cpp_lib_optional) || defined(CPPEMACS_HAVE_CXX17)) || defined(CPPEMACS_DOXYGEN_RUNNING)
+#define CPPEMACS_HAVE_OPTIONAL 1
+#endif
+
 // before C++17, the standard forbids noexcept in typedefs, but not in function parameters,
 // so when using these as function parameters they should (conditionally) be expanded
 #if defined(CPPEMACS_HAVE_CXX17) || defined(CPPEMACS_DOXYGEN_RUNNING)
@@ -792,6 +825,14 @@ concept to_emacs_convertible = requires(T &&a, emacs_env *env) {
  * static_assert(from_emacs_convertible<my_cool_struct>, "Must be from-Emacs-convertible!");
  * @endcode
  *
+ * Such types can also provide a non-throwing overload for @ref
+ * cppemacs::envw::try_extract() "envw::try_extract()":
+ * <code>bool try_from_emacs(expected_type_t<T>, envw env, value x, T &out,
+ * conversion_exit ex) noexcept</code>. This assigns `out` and returns true on
+ * success. On failure it returns false, leaving a non-local exit pending if
+ * `ex` is @ref conversion_exit::keep. Without one, `try_extract()` falls back
+ * to `from_emacs()` and catches any exceptions.
+ *
  * @see @ref cppemacs::envw::extract() "envw::extract()" and @ref
  * cppemacs::cell::extract() "cell::extract()", which perform the conversion.
  *
@@ -836,9 +877,24 @@ inline value to_emacs(expected_type_t<value>, emacs_env *, value x) { return x;
 inline std::string from_emacs(expected_type_t<std::string>, emacs_env *raw_env, value val) noexcept;
 #endif
 
+/**
+ * @brief What @ref envw::try_extract() "try_extract()" does with the non-local
+ * exit of a failed conversion.
+ */
+enum class conversion_exit {
+  /** @brief Clear the non-local exit, so failure is only reported by the
+   * return value. Conversions may also skip building the signal data. */
+  clear,
+  /** @brief Leave the non-local exit pending, as if the conversion had thrown
+   * and been caught by @ref envw::run_catching() "run_catching()". */
+  keep,
+};
+
+struct envw;
 namespace detail {
 template <bool Box> inline void do_box_exceptions(emacs_env *raw) noexcept;
 template <bool Box> inline void do_rethrow(emacs_env *raw);
+template <typename T> inline bool try_extract(envw nv, value val, T &out, conversion_exit ex) noexcept;
 };
 
 /**
@@ -856,6 +912,7 @@ template <bool Box> inline void do_rethrow(emacs_env *raw);
  * @see CPPEMACS_ENABLE_EXCEPTION_BOXING and
  * CPPEMACS_DEFAULT_EXCEPTION_BOXER which can be used to override
  * the default exception boxing behavior.
+ * @see exception_registry to give C++ exception types their own Lisp errors.
  */
 template <bool Box = CPPEMACS_ENABLE_EXCEPTION_BOXING>
 struct default_exception_boxer {
@@ -968,19 +1025,116 @@ static_assert(
  * and maybe_non_local_exit() can be used.
  *
  */
+#if CPPEMACS_ENABLE_CHECKED_ENV
+namespace detail {
+/** @brief The module calls active on this thread, innermost last. */
+inline std::vector<unsigned long long> &active_env_calls() noexcept {
+  static thread_local std::vector<unsigned long long> calls;
+  return calls;
+}
+
+inline unsigned long long next_env_call() noexcept {
+  static std::atomic<unsigned long long> generation(0);
+  return ++generation;
+}
+
+[[noreturn]] inline void checked_env_failure(const char *what) noexcept {
+  std::fprintf(stderr, "cppemacs: envw %s\n", what);
+  std::abort();
+}
+
+/** @brief An @ref emacs_env pointer which checks its thread and call on use. */
+struct checked_env_pointer {
+  static constexpr size_t no_call = size_t(-1);
+
+  emacs_env *ptr;
+  std::thread::id owner;
+  size_t depth;
+  unsigned long long generation;
+
+  checked_env_pointer(emacs_env *ptr) noexcept
+    : ptr(ptr), owner(std::this_thread::get_id()), depth(no_call), generation(0) {
+    std::vector<unsigned long long> &calls = active_env_calls();
+    if (!calls.empty()) {
+      depth = calls.size() - 1;
+      generation = calls.back();
+    }
+  }
+
+  void check() const noexcept {
+    if (std::this_thread::get_id() != owner) checked_env_failure("used on a thread other than its own");
+    if (depth == no_call) return;
+    std::vector<unsigned long long> &calls = active_env_calls();
+    if (depth >= calls.size() || calls[depth] != generation) {
+      checked_env_failure("used after its module call returned");
+    }
+  }
+
+  emacs_env *operator->() const noexcept { check(); return ptr; }
+  emacs_env &operator*() const noexcept { check(); return *ptr; }
+  // conversions may make a fresh envw from this, so check here too
+  operator emacs_env *() const noexcept { check(); return ptr; }
+};
+}
+#endif
+
+/**
+ * @brief Marks the extent of a module call, for @ref CPPEMACS_ENABLE_CHECKED_ENV.
+ *
+ * Environments made while it is alive are invalid once it is destroyed.
+ * Module functions made by cppemacs already do this, raw module functions can
+ * do it themselves. When checking is disabled, this does nothing.
+ *
+ * @code{.cpp}
+ * static value some_module_function(emacs_env *raw_env, ptrdiff_t nargs, value *args, void *data) noexcept {
+ *   env_call_scope scope;
+ *   envw env = raw_env;
+ *   // ...
+ * }
+ * @endcode
+ */
+struct env_call_scope {
+#if CPPEMACS_ENABLE_CHECKED_ENV
+  env_call_scope() noexcept { detail::active_env_calls().push_back(detail::next_env_call()); }
+  ~env_call_scope() { detail::active_env_calls().pop_back(); }
+#else
+  env_call_scope() noexcept {}
+#endif
+  env_call_scope(const env_call_scope &) = delete;
+  env_call_scope &operator=(const env_call_scope &) = delete;
+};
+
 CPPEMACS_SUPPRESS_WCOMPAT_MANGLING_BEGIN
 struct envw {
 private:
+#if CPPEMACS_ENABLE_CHECKED_ENV
+  detail::checked_env_pointer raw;
+public:
+  /** @brief Construct from a raw @ref emacs_env. */
+  envw(emacs_env *raw) noexcept: raw(raw) {}
+  /** @brief Copy the thread and call of another environment. */
+  envw(const detail::checked_env_pointer &raw) noexcept: raw(raw) {}
+#else
   emacs_env *raw;
 public:
   /** @brief Construct from a raw @ref emacs_env. */
   constexpr envw(emacs_env *raw) noexcept: raw(raw) {}
+#endif
+#if CPPEMACS_ENABLE_CHECKED_ENV
+  /** @brief Convert to a raw @ref emacs_env, checking the thread and call. */
+  operator emacs_env *() const noexcept { return raw; }
+  /** @brief Reference the raw @ref emacs_env, checking the thread and call. */
+  emacs_env *operator->() const noexcept { return raw.operator->(); }
+  /** @brief Reference the raw @ref emacs_env, checking the thread and call. */
+  emacs_env &operator*() const noexcept { return *raw; }
+#else
   /** @brief Convert to a raw @ref emacs_env. */
   constexpr operator emacs_env *() const noexcept { return raw; }
   /** @brief Reference the raw @ref emacs_env. */
   constexpr emacs_env *operator->() const noexcept { return raw; }
   /** @brief Reference the raw @ref emacs_env. */
   constexpr emacs_env &operator*() const noexcept { return *raw; }
+#endif
 
   /**
    * @brief The size, in bytes, of the @ref emacs_env in the running Emacs binary.
@@ -1465,6 +1619,53 @@ public:
     return ret;
   }
 
+  /**
+   * @brief Try to convert `val` to `T`, without throwing exceptions.
+   *
+   * Conversions that provide a `try_from_emacs()` overload (see @ref
+   * from_emacs_convertible), which includes all the built-in conversions, run
+   * without throwing at all. Other conversions are run with
+   * run_catching(), so they still throw internally.
+   *
+   * @code
+   * intmax_t i; double d; std::string s;
+   * if (env.try_extract(val, i)) {
+   *   // ...
+   * } else if (env.try_extract(val, d)) {
+   *   // ...
+   * } else if (env.try_extract(val, s)) {
+   *   // ...
+   * }
+   * @endcode
+   *
+   * @param val The value to convert.
+   * @param out Assigned the result, if successful.
+   * @param ex Whether to clear the non-local exit on failure, or leave it
+   * pending.
+   *
+   * @returns Whether the conversion succeeded. If a non-local exit was already
+   * pending, this fails and leaves it pending.
+   */
+  template <FROM_EMACS_TYPE T>
+  bool try_extract(value val, T &out, conversion_exit ex = conversion_exit::clear) const noexcept
+  { return detail::try_extract(raw, val, out, ex); }
+
+#if defined(CPPEMACS_HAVE_OPTIONAL) || defined(CPPEMACS_DOXYGEN_RUNNING)
+  /**
+   * @brief Try to convert `val` to `T`, without throwing exceptions. C++17 only.
+   *
+   * @returns The converted value, or `std::nullopt` if the conversion failed.
+   * @pre `T` is default-constructible.
+   * @see try_extract(value, T &, conversion_exit) const
+   */
+  template <FROM_EMACS_TYPE T>
+  std::optional<T> try_extract(value val, conversion_exit ex = conversion_exit::clear) const noexcept {
+    std::optional<T> ret(std::in_place);
+    if (!try_extract(val, *ret, ex)) ret.reset();
+    return ret;
+  }
+#endif
+
 private:
   // F doesn't throw
   template <class Boxer, typename F, detail::enable_if_t<noexcept(std::declval<F>()()), bool> = true>
@@ -1587,6 +1788,7 @@ public:
     };
     fun_data fdata{&f, nullptr};
     value func = make_function(1, 1, [](emacs_env *raw_env, ptrdiff_t, value *args, void *data) noexcept {
+      env_call_scope scope;
       envw env = raw_env;
       fun_data &fdata = *reinterpret_cast<fun_data*>(data);
       try {
@@ -1608,12 +1810,225 @@ public:
   }
 };
 
+#if !CPPEMACS_ENABLE_CHECKED_ENV
+static_assert(sizeof(envw) == sizeof(emacs_env *), "envw should be just the raw pointer");
+#endif
+
+/**
+ * @brief A registry of C++ exception types with their own Lisp errors.
+ *
+ * Exceptions derived from `std::exception` whose dynamic type has been
+ * registered with define() are signalled as their Lisp error by @ref
+ * envw::run_catching(), rather than as a generic `error`. The registry is
+ * looked up by `typeid`, so only the exact registered type matches.
+ *
+ * With exception boxing (see @ref try_box_exceptions), @ref
+ * envw::rethrow_non_local_exit() converts signals of a registered error back
+ * into the C++ type, if it is constructible from the `std::string` message.
+ *
+ * There is one registry per module, which should be filled in from
+ * `emacs_module_init`, before any of its types are thrown.
+ *
+ * @code{.cpp}
+ * struct parse_error : std::runtime_error { using std::runtime_error::runtime_error; };
+ *
+ * exception_registry::instance().define<parse_error>(
+ *   env, "my-module-parse-error", "Parse error");
+ * @endcode
+ */
+class exception_registry {
+public:
+  /** @brief A registered exception type. */
+  struct entry {
+    /** @brief The error symbol, a global reference. */
+    value symbol;
+    /** @brief Build the signal data for an exception, a list of its message by default. */
+    value (*make_data)(envw env, const entry &ent, const std::exception &err) noexcept;
+    /** @brief Throw the C++ exception for some signal data, or return if it can't. */
+    void (*rethrow)(envw env, const entry &ent, value data);
+  };
+
+  /** @brief Get the registry for this module. */
+  static exception_registry &instance() noexcept {
+    static exception_registry reg;
+    return reg;
+  }
+
+  /**
+   * @brief Define a Lisp error for the exception type `E`, and register it.
+   *
+   * This calls `(define-error NAME MESSAGE PARENT)`. Defining the same type
+   * again replaces the old entry.
+   *
+   * @tparam E The exception type, which must derive from `std::exception`.
+   * @param env The environment.
+   * @param name The name of the error symbol.
+   * @param message The error message, see `define-error`.
+   * @param parent The name of the parent error, `error` by default.
+   * @return The registered entry.
+   */
+  template <typename E>
+  const entry &define(envw env, const char *name, const char *message, const char *parent = "error");
+
+  /** @brief Find the entry for an exact exception type, or null. */
+  const entry *find(const std::type_info &type) const noexcept {
+    if (by_type.empty()) return nullptr;
+    auto it = by_type.find(std::type_index(type));
+    return it == by_type.end() ? nullptr : &it->second;
+  }
+
+  /**
+   * @brief Find the entry registered for an error symbol, or null.
+   *
+   * The entry is stored on the symbol's property list, so this costs a
+   * single call to `get`. Any non-local exit this raises is cleared.
+   */
+  const entry *find(envw env, value symbol) const noexcept;
+
+private:
+  exception_registry() = default;
+
+  // the finalizer of entry user-ptrs, which only identifies them as ours,
+  // since the property can be set by anyone (Lisp or other modules)
+  static void entry_tag(void *) noexcept {}
+
+  template <typename E>
+  static value default_make_data(envw env, const entry &ent, const std::exception &err) noexcept;
+
+  template <typename E>
+  static void default_rethrow(envw env, const entry &ent, value data) {
+    rethrow_as<E>(env, ent, data, std::is_constructible<E, std::string>{});
+  }
+
+  template <typename E>
+  static void rethrow_as(envw env, const entry &ent, value data, std::true_type);
+  template <typename E>
+  static void rethrow_as(envw, const entry &, value, std::false_type) {}
+
+  std::unordered_map<std::type_index, entry> by_type;
+  // global references, made by the first define()
+  value car_fn = nullptr, get_fn = nullptr, list_fn = nullptr, prop = nullptr;
+};
+
+template <typename E>
+const exception_registry::entry &exception_registry::define(
+  envw env, const char *name, const char *message, const char *parent
+) {
+  static_assert(std::is_base_of<std::exception, E>::value,
+                "Only types derived from std::exception can be registered");
+  if (!prop) {
+    car_fn = env.make_global_ref(env.intern("car"));
+    get_fn = env.make_global_ref(env.intern("get"));
+    list_fn = env.make_global_ref(env.intern("list"));
+    prop = env.make_global_ref(env.intern("cppemacs--exception-entry"));
+  }
+
+  value symbol = env.intern(name);
+  env.funcall(env.intern("define-error"), {
+      symbol,
+      env.make_string(message, std::char_traits<char>::length(message)),
+      env.intern(parent)
+    });
+  env.maybe_non_local_exit();
+
+  entry &ent = by_type[std::type_index(typeid(E))];
+  if (ent.symbol) env.free_global_ref(ent.symbol);
+  ent.symbol = env.make_global_ref(symbol);
+  ent.make_data = &default_make_data<E>;
+  ent.rethrow = &default_rethrow<E>;
+
+  // map the symbol back to the entry, whose address is stable
+  env.funcall(env.intern("put"), {
+      symbol, prop,
+      env.make_user_ptr(&entry_tag, static_cast<void *>(&ent))
+    });
+  env.maybe_non_local_exit();
+  return ent;
+}
+
+inline const exception_registry::entry *exception_registry::find(envw env, value symbol) const noexcept {
+  if (by_type.empty()) return nullptr;
+  value ptr = env.funcall(get_fn, {symbol, prop});
+  if (!env.non_local_exit_check() && env.is_not_nil(ptr)
+      && env.get_user_finalizer(ptr) == &entry_tag) {
+    void *ent = env.get_user_ptr(ptr);
+    if (!env.non_local_exit_check()) return static_cast<const entry *>(ent);
+  }
+  env.non_local_exit_clear();
+  return nullptr;
+}
+
+template <typename E>
+value exception_registry::default_make_data(envw env, const entry &, const std::exception &err) noexcept {
+  const char *str = err.what();
+  return env.funcall(instance().list_fn, {
+      env.make_string(str, std::char_traits<char>::length(str))
+    });
+}
+
+template <typename E>
+void exception_registry::rethrow_as(envw env, const entry &, value data, std::true_type) {
+  value msg = env.funcall(instance().car_fn, {data});
+  std::string msg_string = from_emacs(expected_type_t<std::string>{}, env, msg);
+  if (env.non_local_exit_check()) {
+    env.non_local_exit_clear();
+  } else {
+    throw E(std::move(msg_string));
+  }
+}
+
 namespace detail {
 
 inline void exception_ptr_fin(void *v) noexcept {
   delete reinterpret_cast<std::exception_ptr*>(v);
 }
 
+/**
+ * @brief Global references used to box C++ exceptions, created once per
+ * module.
+ *
+ * The first call to get() defines the `cppemacs--exception` error; this is
+ * synchronized by the static local, and retried if it fails.
+ */
+struct boxed_exception_symbols {
+  /** @brief The `cppemacs--exception` error symbol. */
+  value tag;
+  /** @brief The `signal` symbol. */
+  value signal;
+
+  /**
+   * @brief Get the symbols, defining the error on the first call.
+   * @throws non_local_exit If the error could not be defined, with the
+   * non-local exit left pending.
+   */
+  static const boxed_exception_symbols &get(envw env) {
+    static const boxed_exception_symbols syms(env);
+    return syms;
+  }
+
+  /** @brief Get the symbols if get() has already succeeded, or null. */
+  static const boxed_exception_symbols *peek() noexcept {
+    return instance().load(std::memory_order_acquire);
+  }
+
+private:
+  static std::atomic<const boxed_exception_symbols *> &instance() noexcept {
+    static std::atomic<const boxed_exception_symbols *> ptr{nullptr};
+    return ptr;
+  }
+
+  explicit boxed_exception_symbols(envw env)
+    : tag(env.make_global_ref(env.intern("cppemacs--exception"))),
+      signal(env.make_global_ref(env.intern("signal"))) {
+    env.funcall(env.intern("define-error"), {
+        tag,
+        env.make_string("Opaque C++ exception")
+      });
+    if (env.non_local_exit_check()) throw non_local_exit();
+    instance().store(this, std::memory_order_release);
+  }
+};
+
 template <bool Box> inline void do_box_exceptions(emacs_env *raw) noexcept {
   envw env = raw;
   if (env.non_local_exit_check()) return;
@@ -1634,6 +2049,13 @@ template <bool Box> inline void do_box_exceptions(emacs_env *raw) noexcept {
         );
       }
     } catch (const std::exception &err) {
+      if (auto ent = exception_registry::instance().find(typeid(err))) {
+        value data = ent->make_data(env, *ent, err);
+        if (!env.non_local_exit_check()) {
+          env.non_local_exit_signal(ent->symbol, data);
+        }
+        return;
+      }
       CPPEMACS_MAYBE_IF_CONSTEXPR(Box) {
         // std::runtime_error is thrown directly as error
         if (typeid(err) != typeid(std::runtime_error)) {
@@ -1648,28 +2070,24 @@ template <bool Box> inline void do_box_exceptions(emacs_env *raw) noexcept {
     }
   } catch (...) {
     CPPEMACS_MAYBE_IF_CONSTEXPR(Box) {
-      static bool is_init = false;
-      value tag = env.intern("cppemacs--exception");
-      if (!is_init) {
-        env.funcall(env.intern("define-error"), {
-            tag,
-            env.make_string("Opaque C++ exception")
-          });
-        is_init = true;
+      const boxed_exception_symbols *syms;
+      try {
+        syms = &boxed_exception_symbols::get(env);
+      } catch (...) {
+        // leave the exit from define-error pending
+        return;
       }
 
-      if (!env.non_local_exit_check()) {
-        auto eptr = new std::exception_ptr(std::current_exception());
-        value uptr = env.make_user_ptr(
-          &exception_ptr_fin,
-          static_cast<void *>(eptr)
-        );
-        if (env.non_local_exit_check()) {
-          // delete if it didn't make it to the GC
-          delete eptr;
-        } else {
-          env.funcall(env.intern("signal"), {tag, uptr});
-        }
+      auto eptr = new std::exception_ptr(std::current_exception());
+      value uptr = env.make_user_ptr(
+        &exception_ptr_fin,
+        static_cast<void *>(eptr)
+      );
+      if (env.non_local_exit_check()) {
+        // delete if it didn't make it to the GC
+        delete eptr;
+      } else {
+        env.funcall(syms->signal, {syms->tag, uptr});
       }
     } else {
       env.funcall(
@@ -1688,7 +2106,8 @@ template <bool Box> inline void do_rethrow(emacs_env *raw) {
   env.non_local_exit_clear();
   if (kind == funcall_exit::signal_) {
     CPPEMACS_MAYBE_IF_CONSTEXPR (Box) {
-      if (env.eq(symbol, env.intern("error"))) {
+      static const value error_symbol = env.make_global_ref(env.intern("error"));
+      if (env.eq(symbol, error_symbol)) {
         value msg = env.funcall(env.intern("car"), {data});
         std::string msg_string = from_emacs(expected_type_t<std::string>{}, env, msg);
         if (env.non_local_exit_check()) {
@@ -1696,13 +2115,16 @@ template <bool Box> inline void do_rethrow(emacs_env *raw) {
         } else {
           throw std::runtime_error(std::move(msg_string));
         }
-      } if (env.eq(symbol, env.intern("cppemacs--exception"))) {
+      } else if (boxed_exception_symbols::peek() &&
+                 env.eq(symbol, boxed_exception_symbols::peek()->tag)) {
         auto eptr = reinterpret_cast<std::exception_ptr *>(env.get_user_ptr(data));
         if (env.non_local_exit_check()) {
           env.non_local_exit_clear();
         } else if (eptr && *eptr) {
           std::rethrow_exception(*eptr);
         }
+      } else if (auto ent = exception_registry::instance().find(env, symbol)) {
+        ent->rethrow(env, *ent, data);
       }
     }
     throw signalled(symbol, data);
@@ -1712,6 +2134,21 @@ template <bool Box> inline void do_rethrow(emacs_env *raw) {
 }
 }
 
+/**
+ * @brief Define the `cppemacs--exception` error used to box C++ exceptions.
+ *
+ * This is done lazily by the first boxed exception otherwise, but calling it
+ * from `emacs_module_init` lets boxed exceptions from the start be recognised
+ * by @ref envw::rethrow_non_local_exit(), and reports failure early. Calling
+ * it again, from any thread, does nothing.
+ *
+ * @throws non_local_exit If the error could not be defined, with the
+ * non-local exit left pending.
+ */
+inline void register_exception_boxing(envw env) {
+  detail::boxed_exception_symbols::get(env);
+}
+
 #ifndef CPPEMACS_DOXYGEN_RUNNING
 // specializations for is_compatible, these must be defined out of line, GCC complains otherwise
 #  if (EMACS_MAJOR_VERSION >= 25)
@@ -1885,8 +2322,37 @@ template <TO_EMACS_TYPE T> cell envw::inject(T &&arg) const
 
 inline cell from_emacs(expected_type_t<cell>, envw nv, value x) { return cell(nv, x); }
 inline value to_emacs(expected_type_t<cell>, envw, cell x) { return x; }
+inline bool try_from_emacs(expected_type_t<value>, envw, value x, value &out, conversion_exit) noexcept
+{ out = x; return true; }
+inline bool try_from_emacs(expected_type_t<cell>, envw nv, value x, cell &out, conversion_exit) noexcept
+{ out = cell(nv, x); return true; }
 #endif
 
+namespace detail {
+// conversions with a try_from_emacs() overload
+template <typename T>
+inline auto try_extract_impl(int, envw nv, value val, T &out, conversion_exit ex) noexcept
+  -> decltype(try_from_emacs(expected_type_t<T>{}, nv, val, out, ex))
+{ return try_from_emacs(expected_type_t<T>{}, nv, val, out, ex); }
+
+// other conversions, which may throw
+template <typename T>
+inline bool try_extract_impl(long, envw nv, value val, T &out, conversion_exit) noexcept {
+  return nv.run_catching([&]() -> bool {
+    out = nv.extract<T>(val);
+    return true;
+  });
+}
+
+template <typename T>
+inline bool try_extract(envw nv, value val, T &out, conversion_exit ex) noexcept {
+  if (nv.non_local_exit_check()) return false;
+  if (try_extract_impl<T>(0, nv, val, out, ex)) return true;
+  if (ex == conversion_exit::clear) nv.non_local_exit_clear();
+  return false;
+}
+}
+
 /**@}*/
 
 /**
@@ -1906,6 +2372,16 @@ inline std::string from_emacs(expected_type_t<std::string>, emacs_env *raw_env,
   }
   return "";
 }
+/**
+ * @brief Try to convert an Emacs string to a C++ string.
+ * @see envw::try_extract()
+ */
+inline bool try_from_emacs(expected_type_t<std::string>, envw nv, value val, std::string &out, conversion_exit) noexcept {
+  ptrdiff_t len = 0;
+  if (!nv.copy_string_contents(val, nullptr, len)) return false;
+  out.assign(len - 1, '\0');
+  return nv.copy_string_contents(val, &out[0], len);
+}
 /**@}*/
 
 }
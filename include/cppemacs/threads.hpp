@@ -0,0 +1,1020 @@
+/*
+ * Copyright (C) 2024 Eutro <https://eutro.dev>
+ *
+ * This file is part of cppemacs.
+ *
+ * cppemacs is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cppemacs is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cppemacs. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: 2024 Eutro <https://eutro.dev>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CPPEMACS_THREADS_HPP_
+#define CPPEMACS_THREADS_HPP_
+
+#include "utils.hpp"
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
+#if (defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L) || defined(CPPEMACS_DOXYGEN_RUNNING)
+#  include <coroutine>
+#endif
+
+/**
+ * @defgroup cppemacs_threads Threads
+ * @brief Utilities for doing module work off the Emacs thread.
+ *
+ * These are not included by <@ref cppemacs/all.hpp>. Modules including
+ * <@ref cppemacs/threads.hpp> must link with the platform's thread library,
+ * for example `Threads::Threads` in CMake.
+ *
+ * @addtogroup cppemacs_threads
+ * @{
+ */
+namespace cppemacs {
+
+/**
+ * @brief A background thread which destroys objects handed to it by @ref
+ * background_delete.
+ *
+ * The thread is started by the first submit(). The queue is bounded: when it
+ * is full, or the thread cannot be started, objects are destroyed by the
+ * caller instead, so finalizers never block.
+ */
+class background_reclaimer {
+public:
+  /** @brief The default capacity of the queue. */
+  static constexpr size_t default_capacity = 1024;
+
+  /** @brief Get the reclaimer, which is never destroyed. */
+  static background_reclaimer &instance() noexcept {
+    static background_reclaimer *reclaimer = new background_reclaimer();
+    return *reclaimer;
+  }
+
+  /**
+   * @brief Queue `destroy(ptr)` to be called on the background thread.
+   * @return Whether it was queued, if not the caller must destroy `ptr`.
+   */
+  bool submit(void *ptr, void (*destroy)(void *) noexcept) noexcept {
+    try {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (queue.size() >= max_size) return false;
+      if (!started) {
+        std::thread(&background_reclaimer::run, this).detach();
+        started = true;
+      }
+      queue.push_back(item{ptr, destroy});
+    } catch (...) {
+      return false;
+    }
+    cv_work.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Wait until every object queued so far has been destroyed.
+   *
+   * Call this before module state the destructors depend on goes away, such as
+   * at exit.
+   */
+  void flush() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv_idle.wait(lock, [this]() { return queue.empty() && !busy; });
+  }
+
+  /** @brief Set the maximum number of queued objects. */
+  void set_capacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mtx);
+    max_size = capacity;
+  }
+
+  /** @brief Get the number of objects waiting to be destroyed. */
+  size_t pending() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return queue.size() + (busy ? 1 : 0);
+  }
+
+private:
+  struct item {
+    void *ptr;
+    void (*destroy)(void *) noexcept;
+  };
+
+  std::mutex mtx;
+  std::condition_variable cv_work, cv_idle;
+  std::deque<item> queue;
+  size_t max_size = default_capacity;
+  bool started = false, busy = false;
+
+  background_reclaimer() = default;
+
+  void run() noexcept {
+    std::unique_lock<std::mutex> lock(mtx);
+    for (;;) {
+      cv_work.wait(lock, [this]() { return !queue.empty(); });
+      item it = queue.front();
+      queue.pop_front();
+      busy = true;
+      lock.unlock();
+      it.destroy(it.ptr);
+      lock.lock();
+      busy = false;
+      if (queue.empty()) cv_idle.notify_all();
+    }
+  }
+};
+
+/**
+ * @brief A @ref user_ptr `Deleter` which destroys objects on a background
+ * thread, rather than during garbage collection.
+ *
+ * This is worthwhile for objects with expensive destructors, like large
+ * indexes or memory maps. The destructor must be safe to run on another
+ * thread, and must not use any Emacs environment.
+ *
+ * @tparam T The type of the object.
+ * @tparam Deleter The deleter called on the background thread. This must be
+ * thread-safe, so @ref pooled_delete, whose pools rely on Emacs' global lock,
+ * is rejected.
+ *
+ * @see background_reclaimer::flush() to wait for queued objects.
+ */
+template <typename T, typename Deleter = std::default_delete<T>>
+struct background_delete {
+  static_assert(!detail::deleter_needs_emacs_lock<Deleter>::value,
+                "Deleter must be thread-safe, pooled_delete cannot run on the reclaimer thread");
+
+  /** @brief Queue the object to be destroyed, or destroy it now if the queue is full. */
+  void operator()(T *ptr) const noexcept {
+    if (!background_reclaimer::instance().submit(static_cast<void *>(ptr), &destroy)) {
+      destroy(ptr);
+    }
+  }
+
+  /** @brief Destroy the object with `Deleter`. */
+  static void destroy(void *ptr) noexcept {
+    try {
+      Deleter()(static_cast<T *>(ptr));
+    } catch (...) {
+      // deliberately dropped, like exceptions from user_ptr finalizers
+    }
+  }
+};
+
+namespace detail {
+/** @brief Whether this thread is a @ref thread_pool worker, which must never use an Emacs environment. */
+inline bool &on_worker_thread() noexcept {
+  static thread_local bool worker = false;
+  return worker;
+}
+}
+
+/**
+ * @brief A fixed-size pool of worker threads.
+ *
+ * The destructor waits for all posted jobs to finish.
+ *
+ * @see async_channel to deliver job results back to Lisp.
+ * @see message_channel to send other messages back to Lisp.
+ */
+class thread_pool {
+public:
+  /** @brief Start `threads` worker threads, or one per hardware thread if 0. */
+  explicit thread_pool(size_t threads = 0) {
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (!threads) threads = 1;
+    workers.reserve(threads);
+    try {
+      for (size_t ii = 0; ii < threads; ++ii) {
+        workers.emplace_back(&thread_pool::run, this);
+      }
+    } catch (...) {
+      shutdown();
+      throw;
+    }
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  /** @brief Finish all posted jobs, and stop the workers. */
+  ~thread_pool() { shutdown(); }
+
+  /** @brief Run `job` on a worker thread. Exceptions it throws are ignored. */
+  void post(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+  }
+
+  /** @brief Get the number of worker threads. */
+  size_t size() const noexcept { return workers.size(); }
+
+private:
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> jobs;
+  std::vector<std::thread> workers;
+  bool stopping = false;
+
+  void shutdown() noexcept {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopping = true;
+    }
+    cv.notify_all();
+    for (std::thread &worker : workers) worker.join();
+    workers.clear();
+  }
+
+  void run() noexcept {
+    detail::on_worker_thread() = true;
+    std::unique_lock<std::mutex> lock(mtx);
+    for (;;) {
+      cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (jobs.empty()) return;
+      std::function<void()> job = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      try {
+        job();
+      } catch (...) {
+        // deliberately dropped, jobs that can fail report it through their own results
+      }
+      lock.lock();
+    }
+  }
+};
+
+/**
+ * @brief A lock-free queue with many producers, and one consumer.
+ *
+ * Any thread may push() items, which are received by drain() in the order they
+ * were pushed. push() reports whether the queue was empty, so a producer can
+ * wake the consumer once per batch, rather than once per item.
+ *
+ * @see message_channel to deliver items to Lisp.
+ */
+template <typename T>
+class mpsc_queue {
+  struct node {
+    T item;
+    node *next;
+  };
+
+  // frees the rest of a batch, if draining it throws
+  struct chain {
+    node *first;
+    ~chain() {
+      while (first) {
+        node *n = first;
+        first = n->next;
+        delete n;
+      }
+    }
+  };
+
+public:
+  mpsc_queue() noexcept : head(nullptr) {}
+  mpsc_queue(const mpsc_queue &) = delete;
+  mpsc_queue &operator=(const mpsc_queue &) = delete;
+  ~mpsc_queue() {
+    chain rest{head.load(std::memory_order_acquire)};
+    (void)rest;
+  }
+
+  /**
+   * @brief Push an item. Safe to call from any thread.
+   * @return Whether the queue was empty before.
+   */
+  bool push(T item) {
+    node *n = new node{std::move(item), nullptr};
+    // n belongs to the consumer once it is published, so only read old
+    node *old = head.load(std::memory_order_relaxed);
+    do {
+      n->next = old;
+    } while (!head.compare_exchange_weak(old, n, std::memory_order_release, std::memory_order_relaxed));
+    return !old;
+  }
+
+  /**
+   * @brief Call `f` with each queued item, oldest first. Only one thread may
+   * drain at a time.
+   *
+   * If `f` throws, the rest of the batch is discarded.
+   *
+   * @return The number of items drained.
+   */
+  template <typename F>
+  size_t drain(F &&f) {
+    // the items are pushed onto a stack, so reverse them
+    node *batch = head.exchange(nullptr, std::memory_order_acquire);
+    chain fifo{nullptr};
+    while (batch) {
+      node *next = batch->next;
+      batch->next = fifo.first;
+      fifo.first = batch;
+      batch = next;
+    }
+    size_t count = 0;
+    while (fifo.first) {
+      std::unique_ptr<node> n(fifo.first);
+      fifo.first = n->next;
+      f(std::move(n->item));
+      ++count;
+    }
+    return count;
+  }
+
+  /** @brief Whether the queue is currently empty. */
+  bool empty() const noexcept { return !head.load(std::memory_order_acquire); }
+
+private:
+  std::atomic<node *> head;
+};
+
+#if (EMACS_MAJOR_VERSION >= 26)
+namespace detail {
+/** @brief The chunks of a @ref parallel_transform(), shared with the helpers on the pool. */
+struct parallel_state {
+  size_t count = 0, chunk = 1, chunks = 0;
+  std::atomic<size_t> next;
+  std::atomic<bool> cancelled;
+  /** @brief Transform the elements in `[begin, end)`, stopping early if cancelled. */
+  std::function<void(size_t begin, size_t end, const std::atomic<bool> &cancelled)> work;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  size_t finished = 0;
+  std::exception_ptr exn;
+
+  parallel_state() noexcept : next(0), cancelled(false) {}
+
+  /**
+   * @brief Claim and run chunks until none are left, skipping them if
+   * cancelled. Helpers that start late find nothing to claim, and never touch
+   * the buffers.
+   */
+  void help() noexcept {
+    for (;;) {
+      size_t c = next.fetch_add(1, std::memory_order_relaxed);
+      if (c >= chunks) return;
+      std::exception_ptr failure;
+      if (!cancelled.load(std::memory_order_relaxed)) {
+        try {
+          work(c * chunk, c * chunk + chunk < count ? c * chunk + chunk : count, cancelled);
+        } catch (...) {
+          failure = std::current_exception();
+          cancelled = true;
+        }
+      }
+      std::lock_guard<std::mutex> lock(mtx);
+      if (failure && !exn) exn = failure;
+      if (++finished == chunks) cv.notify_all();
+    }
+  }
+
+  /** @brief Skip the chunks not yet started, and wait for the rest. */
+  void cancel() noexcept {
+    cancelled = true;
+    help();
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this]() { return finished == chunks; });
+  }
+};
+
+template <typename T>
+struct parallel_slot { T val; };
+}
+
+/**
+ * @brief Transform each element of the Lisp sequence `input` with `fn` on
+ * `pool`, and return a vector of the @ref cppemacs_conversions "converted"
+ * results.
+ *
+ * The elements are extracted as `In` on the main thread, into a staging
+ * buffer. The buffer is split into chunks, which the pool's workers claim one
+ * at a time until none are left, so faster workers take more chunks. Meanwhile
+ * the main thread waits, checking for quits with a @ref quit_checker every
+ * `quit_interval`. Finally the results are converted on the main thread.
+ *
+ * @code{.cpp}
+ * value hashes = parallel_transform<std::string>(
+ *   env, files, [](const std::string &file) { return hash_file(file); }, pool);
+ * @endcode
+ *
+ * `fn` is called with `const In &` on worker threads, so it must not use any
+ * Emacs environment. Its result type must be default-constructible.
+ *
+ * @throws non_local_exit (or as configured by @ref
+ * CPPEMACS_DEFAULT_EXCEPTION_BOXER) if a conversion fails, or the user quits.
+ * @throws any exception thrown by `fn`, after the other chunks are finished.
+ */
+template <FROM_EMACS_TYPE In, typename F>
+value parallel_transform(
+  envw nv, value input, F &&fn, thread_pool &pool,
+  std::chrono::nanoseconds quit_interval = std::chrono::milliseconds(10)
+) {
+  using Out = detail::decay_t<decltype(fn(std::declval<const In &>()))>;
+#ifdef CPPEMACS_HAVE_IS_INVOCABLE
+  static_assert(!std::is_invocable<F &, envw, const In &>::value,
+                "parallel_transform functions run on worker threads, and must not take an environment");
+#endif
+  assert(!detail::on_worker_thread() && "parallel_transform must be called on the main thread");
+  quit_checker quit(nv, quit_interval);
+
+  if (!nv.eq(nv.type_of(input), nv.intern("vector"))) {
+    input = nv.funcall(nv.intern("vconcat"), {input});
+    nv.maybe_non_local_exit();
+  }
+  size_t count = size_t(nv.vec_size(input));
+  nv.maybe_non_local_exit();
+  // slots, since std::vector<bool> has no data()
+  std::vector<detail::parallel_slot<In>> staged;
+  staged.reserve(count);
+  for (size_t ii = 0; ii < count; ++ii) {
+    staged.push_back(detail::parallel_slot<In>{nv.extract<In>(nv.vec_get(input, ptrdiff_t(ii)))});
+    quit.tick();
+  }
+
+  std::vector<detail::parallel_slot<Out>> results(count);
+  std::shared_ptr<detail::parallel_state> st = std::make_shared<detail::parallel_state>();
+  st->count = count;
+  st->chunk = count / (pool.size() * 8);
+  if (!st->chunk) st->chunk = 1;
+  st->chunks = (count + st->chunk - 1) / st->chunk;
+  const detail::parallel_slot<In> *in = staged.data();
+  detail::parallel_slot<Out> *out = results.data();
+  st->work = [in, out, &fn](size_t begin, size_t end, const std::atomic<bool> &cancelled) {
+    for (size_t ii = begin; ii < end && !cancelled.load(std::memory_order_relaxed); ++ii) {
+      out[ii].val = fn(in[ii].val);
+    }
+  };
+  if (st->chunks) {
+    try {
+      for (size_t ii = 0; ii < pool.size(); ++ii) pool.post([st]() { st->help(); });
+    } catch (...) {
+      // do the rest here instead
+      st->help();
+    }
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(st->mtx);
+    while (!st->cv.wait_for(lock, quit_interval, [&st]() { return st->finished == st->chunks; })) {
+      lock.unlock();
+      try {
+        quit.check();
+      } catch (...) {
+        st->cancel();
+        throw;
+      }
+      lock.lock();
+    }
+  }
+  if (st->exn) std::rethrow_exception(st->exn);
+
+  value output = nv.funcall(nv.intern("make-vector"), {nv->*intmax_t(count), nv.intern("nil")});
+  nv.maybe_non_local_exit();
+  for (size_t ii = 0; ii < count; ++ii) {
+    nv.vec_set(output, ptrdiff_t(ii), nv->*std::move(results[ii].val));
+    nv.maybe_non_local_exit();
+    quit.tick();
+  }
+  return output;
+}
+#endif
+
+#if (EMACS_MAJOR_VERSION >= 28)
+namespace detail {
+/** @brief Write a wakeup byte to a channel from @ref envw::open_channel(). */
+inline void write_wakeup(int fd) noexcept {
+  char byte = 0;
+#ifdef _WIN32
+  (void)_write(fd, &byte, 1);
+#else
+  while (::write(fd, &byte, 1) < 0 && errno == EINTR);
+#endif
+}
+
+/** @brief Close a channel from @ref envw::open_channel(). */
+inline void close_channel(int fd) noexcept {
+#ifdef _WIN32
+  _close(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+/**
+ * @brief Make a pipe process with `filter`, and open a channel to it in `fd`.
+ * @throws non_local_exit (or as configured by @ref
+ * CPPEMACS_DEFAULT_EXCEPTION_BOXER) if either fails.
+ */
+inline global_ref make_channel_process(envw nv, const char *name, value filter, int &fd) {
+  value args[] = {
+    nv.intern(":name"), nv.make_string(name, std::char_traits<char>::length(name)),
+    nv.intern(":noquery"), nv.intern("t"),
+    nv.intern(":coding"), nv.intern("binary"),
+    nv.intern(":filter"), filter,
+  };
+  value proc = nv.funcall(nv.intern("make-pipe-process"), sizeof(args) / sizeof(*args), args);
+  nv.maybe_non_local_exit();
+  fd = nv.open_channel(proc);
+  nv.maybe_non_local_exit();
+  return global_ref(nv, proc);
+}
+
+/** @brief Something to do on the main thread once a job has finished. */
+struct async_completion {
+  virtual ~async_completion() = default;
+  /** @brief Deliver the completion, with the filter's environment. */
+  virtual void deliver(envw nv) = 0;
+};
+
+/** @brief The result of a job, or the exception it threw. */
+template <typename R>
+struct async_result {
+  std::exception_ptr exn;
+  // false until the job has returned, it may never run at all
+  bool has_value = false;
+  union { R val; };
+
+  async_result() noexcept {}
+  ~async_result() { if (has_value) val.~R(); }
+
+  template <typename F>
+  void run(F &f) {
+    try {
+      new (&val) R(f());
+      has_value = true;
+    } catch (...) {
+      exn = std::current_exception();
+    }
+  }
+
+  R get() {
+    if (exn) std::rethrow_exception(exn);
+    return std::move(val);
+  }
+};
+
+template <>
+struct async_result<void> {
+  std::exception_ptr exn;
+
+  template <typename F>
+  void run(F &f) {
+    try {
+      f();
+    } catch (...) {
+      exn = std::current_exception();
+    }
+  }
+
+  void get() { if (exn) std::rethrow_exception(exn); }
+};
+
+template <typename R>
+inline value convert_async_result(envw nv, async_result<R> &r) { return nv->*r.get(); }
+inline value convert_async_result(envw nv, async_result<void> &r) { r.get(); return nv.intern("nil"); }
+
+/** @brief A finished job, whose result is passed to a Lisp callback. */
+template <typename R>
+struct async_callback : async_completion {
+  /** @brief The function to call with the result. */
+  global_ref callback;
+  async_result<R> res;
+
+  void deliver(envw nv) override {
+    value result = convert_async_result(nv, res);
+    nv.funcall(callback, 1, &result);
+  }
+};
+
+/** @brief The state shared between an @ref async_channel, its filter, and jobs in flight. */
+struct async_channel_state {
+  int fd = -1;
+  mpsc_queue<std::unique_ptr<async_completion>> done;
+
+  ~async_channel_state() { if (fd >= 0) close_channel(fd); }
+
+  /**
+   * @brief Queue a completion, and wake up the main thread if nothing else is
+   * queued. Called on a worker.
+   */
+  void complete(std::unique_ptr<async_completion> c) {
+    if (done.push(std::move(c))) write_wakeup(fd);
+  }
+
+  /** @brief Deliver all queued results. Called by the process filter. */
+  void deliver(envw nv) {
+    // deliver everything, then raise the first error
+    value sym = nullptr, data = nullptr;
+    funcall_exit first = funcall_exit::return_;
+    done.drain([&](std::unique_ptr<async_completion> c) {
+      nv.run_catching([&]() { c->deliver(nv); });
+      if (nv.non_local_exit_check()) {
+        if (!first) first = nv.non_local_exit_get(sym, data);
+        nv.non_local_exit_clear();
+      }
+    });
+    if (first == funcall_exit::signal_) nv.non_local_exit_signal(sym, data);
+    else if (first == funcall_exit::throw_) nv.non_local_exit_throw(sym, data);
+  }
+};
+}
+
+#if (defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L) || defined(CPPEMACS_DOXYGEN_RUNNING)
+/** @brief Defined if @ref async_task is available. */
+#define CPPEMACS_HAVE_COROUTINES 1
+
+/**
+ * @brief The return type of module function coroutines, which can `co_await`
+ * jobs with @ref async_channel::background(). C++20 only.
+ *
+ * The coroutine starts running on the main thread as soon as it is called. When
+ * it awaits a job, it is parked, and the module function returns nil. Once the
+ * job finishes, the coroutine is resumed on the main thread by the channel's
+ * process filter, with its `envw` parameter set to the filter's environment.
+ *
+ * @code{.cpp}
+ * env->*make_typed_function(
+ *   "Index FILE in the background, then call DONE with the number of entries.",
+ *   [](envw env, std::string file, value done) -> async_task {
+ *     global_ref callback(env, done);
+ *     auto entries = co_await channel->background(pool, [file]() { return read_index(file); });
+ *     auto count = co_await channel->background(pool, [&entries]() { return merge(entries); });
+ *     env.funcall(callback, {env->*count});
+ *   });
+ * @endcode
+ *
+ * Parameters should be taken by value, since the coroutine outlives the call.
+ * Only the `envw` is updated when the coroutine is resumed, other local values
+ * belong to the call that created them, so anything used across a `co_await`
+ * must be held in a @ref global_ref.
+ *
+ * Errors escaping the coroutine are signalled by the module function if they
+ * happen before the first `co_await`, and by the process filter otherwise.
+ */
+class async_task {
+public:
+  struct promise_type;
+  /** @brief The coroutine handle type. */
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  /** @brief The coroutine promise type. */
+  struct promise_type {
+    /** @brief The coroutine's `envw` parameter, if any. */
+    envw *env;
+    /** @brief The exception that escaped the coroutine, if any. */
+    std::exception_ptr exn;
+    /** @brief Whether the coroutine should destroy itself when it finishes. */
+    bool detached = false;
+
+    /** @brief Find the `envw` among the coroutine's parameters. */
+    template <typename... Args>
+    promise_type(Args &...args) noexcept : env(find_env(args...)) {}
+
+    async_task get_return_object() noexcept { return async_task(handle_type::from_promise(*this)); }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_always final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() noexcept { exn = std::current_exception(); }
+
+  private:
+    static envw *find_env() noexcept { return nullptr; }
+    template <typename A, typename... Rest>
+    static envw *find_env(A &arg, Rest &...rest) noexcept {
+      envw *found = env_of(arg);
+      return found ? found : find_env(rest...);
+    }
+    static envw *env_of(envw &nv) noexcept { return &nv; }
+    template <typename A>
+    static envw *env_of(A &) noexcept { return nullptr; }
+  };
+
+  async_task(async_task &&o) noexcept : handle(o.handle) { o.handle = nullptr; }
+  async_task &operator=(async_task &&) = delete;
+  /** @brief Destroy the coroutine if it has finished, otherwise detach it. */
+  ~async_task() {
+    if (!handle) return;
+    if (handle.done()) handle.destroy();
+    else handle.promise().detached = true;
+  }
+
+  /** @brief Whether the coroutine has finished. */
+  bool done() const noexcept { return !handle || handle.done(); }
+
+  /**
+   * @brief Let the coroutine finish on its own.
+   * @throws any exception that escaped the coroutine, if it has already finished.
+   */
+  void detach() {
+    handle_type h = handle;
+    if (!h) return;
+    handle = nullptr;
+    if (h.done()) {
+      std::exception_ptr exn = h.promise().exn;
+      h.destroy();
+      if (exn) std::rethrow_exception(exn);
+    } else {
+      h.promise().detached = true;
+    }
+  }
+
+  /** @brief Detach the coroutine, and return nil. */
+  friend value to_emacs(expected_type_t<async_task>, envw nv, async_task &&task) {
+    task.detach();
+    return nv.intern("nil");
+  }
+
+private:
+  explicit async_task(handle_type handle) noexcept : handle(handle) {}
+  handle_type handle;
+};
+
+namespace detail {
+/** @brief Resumes a parked @ref async_task with the filter's environment. */
+struct async_resumption : async_completion {
+  async_task::handle_type handle;
+
+  explicit async_resumption(async_task::handle_type handle) noexcept : handle(handle) {}
+
+  void deliver(envw nv) override {
+    async_task::promise_type &promise = handle.promise();
+    if (promise.env) *promise.env = nv;
+    handle.resume();
+    if (handle.done() && promise.detached) {
+      std::exception_ptr exn = promise.exn;
+      handle.destroy();
+      if (exn) std::rethrow_exception(exn);
+    }
+  }
+};
+
+/** @brief The awaitable returned by @ref async_channel::background(). */
+template <typename F>
+class background_awaiter {
+  using result_type = decay_t<decltype(std::declval<F &>()())>;
+public:
+  background_awaiter(std::shared_ptr<async_channel_state> state, thread_pool &pool, F &&job)
+    : state(std::move(state)), pool(&pool), job(std::move(job)) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(async_task::handle_type handle) {
+    // allocated here, so a worker can never fail to resume the coroutine
+    resumption.reset(new async_resumption(handle));
+    std::shared_ptr<async_channel_state> st = state;
+    background_awaiter *self = this;
+    pool->post([st, self]() {
+      self->res.run(self->job);
+      st->complete(std::move(self->resumption));
+    });
+  }
+
+  result_type await_resume() { return res.get(); }
+
+private:
+  std::shared_ptr<async_channel_state> state;
+  thread_pool *pool;
+  F job;
+  async_result<result_type> res;
+  std::unique_ptr<async_completion> resumption;
+};
+}
+#endif
+
+/**
+ * @brief Delivers the results of jobs run on a @ref thread_pool back to Lisp
+ * callbacks, on the main thread.
+ *
+ * This makes a pipe process with `make-pipe-process`, and opens a channel to
+ * it with @ref envw::open_channel(). When a job finishes, its result is queued,
+ * and a byte is written to the channel unless earlier results are still waiting. The process filter then @ref
+ * cppemacs_conversions "converts" the queued results and calls their
+ * callbacks, so module functions can start long jobs and return immediately.
+ *
+ * @code{.cpp}
+ * static thread_pool pool;
+ * static async_channel *channel = new async_channel(env);
+ * // in a module function
+ * channel->run(env, pool, callback, [input]() { return expensive(input); });
+ * @endcode
+ *
+ * Errors from jobs, conversions or callbacks are signalled from the process
+ * filter, after all the ready results have been delivered.
+ */
+class async_channel {
+public:
+  /**
+   * @brief Make the pipe process, and open a channel to it.
+   * @throws non_local_exit (or as configured by @ref
+   * CPPEMACS_DEFAULT_EXCEPTION_BOXER) if either fails.
+   */
+  explicit async_channel(envw nv, const char *name = "cppemacs-async")
+    : state(std::make_shared<detail::async_channel_state>()) {
+    std::shared_ptr<detail::async_channel_state> st = state;
+    value filter = nv->*make_spreader_function(
+      spreader_arity<2>(), "Deliver the results of finished C++ jobs.",
+      [st](envw nv, value, value) {
+        st->deliver(nv);
+        nv.maybe_non_local_exit();
+        return nullptr;
+      });
+    nv.maybe_non_local_exit();
+    process_ref = detail::make_channel_process(nv, name, filter, state->fd);
+  }
+
+  /** @brief Get the pipe process. */
+  value process() const noexcept { return process_ref; }
+
+  /**
+   * @brief Run `job` on `pool`, and call `callback` with its @ref
+   * cppemacs_conversions "converted" result on the main thread.
+   *
+   * `job` is called with no arguments on a worker thread, and must not use any
+   * Emacs environment. Its result is converted once it is delivered, so it
+   * should own its data.
+   */
+  template <typename F>
+  void run(envw nv, thread_pool &pool, value callback, F &&job) {
+    using R = detail::decay_t<decltype(std::declval<detail::decay_t<F> &>()())>;
+    using completion = detail::async_callback<R>;
+    std::unique_ptr<completion> c(new completion());
+    c->callback = global_ref(nv, callback);
+    nv.maybe_non_local_exit();
+
+    // std::function needs copyable jobs
+    auto shared_job = std::make_shared<detail::decay_t<F>>(std::forward<F>(job));
+    auto shared_c = std::make_shared<std::unique_ptr<completion>>(std::move(c));
+    std::shared_ptr<detail::async_channel_state> st = state;
+    pool.post([st, shared_job, shared_c]() {
+      (*shared_c)->res.run(*shared_job);
+      st->complete(std::move(*shared_c));
+    });
+  }
+
+#if defined(CPPEMACS_HAVE_COROUTINES) || defined(CPPEMACS_DOXYGEN_RUNNING)
+  /**
+   * @brief Run `job` on `pool` when awaited by an @ref async_task, and resume
+   * the task on the main thread once it finishes. C++20 only.
+   *
+   * The `co_await` expression gives the job's result, or rethrows its
+   * exception. As with run(), `job` must not use any Emacs environment.
+   */
+  template <typename F>
+  detail::background_awaiter<detail::decay_t<F>> background(thread_pool &pool, F &&job) const {
+    return detail::background_awaiter<detail::decay_t<F>>(state, pool, detail::decay_t<F>(std::forward<F>(job)));
+  }
+#endif
+
+  /**
+   * @brief Delete the pipe process. Jobs still running are not delivered, and
+   * coroutines awaiting them are never resumed.
+   */
+  void close(envw nv) {
+    if (process_ref) {
+      nv.funcall(nv.intern("delete-process"), {process_ref.get()});
+      process_ref.reset(nv);
+    }
+  }
+
+private:
+  std::shared_ptr<detail::async_channel_state> state;
+  global_ref process_ref;
+};
+
+namespace detail {
+/** @brief The state shared between a @ref message_channel, its filter, and senders. */
+template <typename T>
+struct message_channel_state {
+  int fd = -1;
+  mpsc_queue<T> queue;
+
+  ~message_channel_state() { if (fd >= 0) close_channel(fd); }
+};
+}
+
+/**
+ * @brief Delivers messages sent from any thread to a Lisp handler, in batches,
+ * on the main thread.
+ *
+ * Messages are queued on an @ref mpsc_queue, and a byte is written to the
+ * channel only when the queue was empty, so a burst of messages costs one
+ * wakeup. The process filter then @ref cppemacs_conversions "converts" every
+ * queued message, and calls the handler once with a list of them, oldest first.
+ *
+ * @code{.cpp}
+ * static message_channel<std::string> *lines =
+ *   new message_channel<std::string>(env, env.intern("my-tail-handle-lines"));
+ * // on any thread
+ * lines->send(std::move(line));
+ * @endcode
+ */
+template <typename T>
+class message_channel {
+  using state_type = detail::message_channel_state<T>;
+
+public:
+  /**
+   * @brief Make the pipe process, and open a channel to it.
+   * @throws non_local_exit (or as configured by @ref
+   * CPPEMACS_DEFAULT_EXCEPTION_BOXER) if either fails.
+   */
+  message_channel(envw nv, value handler, const char *name = "cppemacs-messages")
+    : state(std::make_shared<state_type>()) {
+    std::shared_ptr<state_type> st = state;
+    // std::function needs copyable captures
+    std::shared_ptr<global_ref> handler_ref = std::make_shared<global_ref>(nv, handler);
+    nv.maybe_non_local_exit();
+    value filter = nv->*make_spreader_function(
+      spreader_arity<2>(), "Deliver messages from C++ threads.",
+      [st, handler_ref](envw nv, value, value) {
+        value messages = drain(nv, *st);
+        if (nv.is_not_nil(messages)) nv.funcall(handler_ref->get(), {messages});
+        nv.maybe_non_local_exit();
+        return nullptr;
+      });
+    nv.maybe_non_local_exit();
+    process_ref = detail::make_channel_process(nv, name, filter, state->fd);
+  }
+
+  /** @brief Get the pipe process. */
+  value process() const noexcept { return process_ref; }
+
+  /**
+   * @brief Queue `message`, and wake up the main thread if nothing else is
+   * queued. Safe to call from any thread.
+   */
+  void send(T message) {
+    if (state->queue.push(std::move(message))) detail::write_wakeup(state->fd);
+  }
+
+  /**
+   * @brief Convert all the queued messages now, and return them as a list,
+   * oldest first.
+   * @throws non_local_exit (or as configured by @ref
+   * CPPEMACS_DEFAULT_EXCEPTION_BOXER) if a conversion fails, and the rest of
+   * the batch is discarded.
+   */
+  value drain(envw nv) { return drain(nv, *state); }
+
+  /** @brief Delete the pipe process. Messages still queued are not delivered. */
+  void close(envw nv) {
+    if (process_ref) {
+      nv.funcall(nv.intern("delete-process"), {process_ref.get()});
+      process_ref.reset(nv);
+    }
+  }
+
+private:
+  std::shared_ptr<state_type> state;
+  global_ref process_ref;
+
+  static value drain(envw nv, state_type &st) {
+    std::vector<value> messages;
+    st.queue.drain([&](T &&message) {
+      messages.push_back(nv->*std::move(message));
+      nv.maybe_non_local_exit();
+    });
+    return nv.funcall(nv.intern("list"), static_cast<ptrdiff_t>(messages.size()), messages.data());
+  }
+};
+#endif
+
+/** @} */
+}
+
+#endif /* CPPEMACS_THREADS_HPP_ */
@@ -26,7 +26,16 @@
 
 #include "core.hpp"
 #include "conversions.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <memory>
+#include <new>
+#include <typeinfo>
+#ifdef __GNUG__
+#  include <cxxabi.h>
+#endif
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
@@ -39,6 +48,192 @@
  */
 namespace cppemacs {
 
+/**
+ * @brief Reports the native memory held by a @ref user_ptr object of type `T`,
+ * for @ref native_memory accounting.
+ *
+ * By default, types with a `size_t memory_size() const` member are accounted
+ * with it, and other types are not accounted at all. Specialize this with
+ * `enabled` and `get()` to account for other types.
+ *
+ * The size of an object should not change while it is owned by Emacs, use
+ * @ref native_memory::allocated() and @ref native_memory::freed() to account
+ * for changes.
+ */
+template <typename T, typename = void>
+struct user_ptr_memory_size {
+  /** @brief Whether objects of type `T` are accounted. */
+  static constexpr bool enabled = false;
+  /** @brief Get the number of bytes held by `obj`. */
+  static size_t get(const T &obj) noexcept { return sizeof(obj); }
+};
+#ifndef CPPEMACS_DOXYGEN_RUNNING
+template <typename T>
+struct user_ptr_memory_size<T, detail::void_t<decltype(size_t(std::declval<const T &>().memory_size()))>> {
+  static constexpr bool enabled = true;
+  static size_t get(const T &obj) noexcept { return obj.memory_size(); }
+};
+#endif
+
+/** @brief Native memory statistics, see @ref native_memory. */
+struct native_memory_stats {
+  /** @brief The number of bytes held by live objects. */
+  size_t live_bytes;
+  /** @brief The number of live objects. */
+  size_t live_objects;
+  /** @brief The number of bytes allocated since the last garbage collection. */
+  size_t allocated_since_gc;
+};
+
+/**
+ * @brief Accounting of the native memory held by @ref user_ptr objects, which
+ * Emacs' garbage collector cannot see.
+ *
+ * Objects of types enabled by @ref user_ptr_memory_size are counted when they
+ * are passed to Emacs, and when they are finalized. If a GC threshold is set,
+ * and more than that many bytes have been allocated since the last garbage
+ * collection, the next @ref module_function call runs `garbage-collect` first,
+ * so Lisp garbage pinning large native objects is collected promptly.
+ *
+ * @see install_native_memory_accounting() to make the statistics available
+ * to Lisp, and reset the count after each garbage collection.
+ */
+class native_memory {
+public:
+  /** @brief Per-type statistics. */
+  struct account {
+    /** @brief The name of the type. */
+    const char *name;
+    /** @brief The number of bytes held by live objects of the type. */
+    std::atomic<size_t> live_bytes{0};
+    /** @brief The number of live objects of the type. */
+    std::atomic<size_t> live_objects{0};
+    /** @brief The next account, in the order they were created. */
+    account *next = nullptr;
+
+    /** @brief Create and register an account. */
+    explicit account(const char *name) noexcept: name(name) {
+      next = state().accounts.load(std::memory_order_relaxed);
+      while (!state().accounts.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed));
+    }
+  };
+
+  /** @brief Get the account for `T`. */
+  template <typename T>
+  static account &account_of() noexcept {
+    static account acct(type_name(typeid(T)));
+    return acct;
+  }
+
+  /** @brief Record `bytes` allocated for an object of type `T`. */
+  template <typename T>
+  static void allocated(size_t bytes, size_t objects = 1) noexcept {
+    account &acct = account_of<T>();
+    acct.live_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    acct.live_objects.fetch_add(objects, std::memory_order_relaxed);
+    state().live_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    state().live_objects.fetch_add(objects, std::memory_order_relaxed);
+    state().since_gc.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  /** @brief Record `bytes` freed by an object of type `T`. */
+  template <typename T>
+  static void freed(size_t bytes, size_t objects = 1) noexcept {
+    account &acct = account_of<T>();
+    acct.live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    acct.live_objects.fetch_sub(objects, std::memory_order_relaxed);
+    state().live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    state().live_objects.fetch_sub(objects, std::memory_order_relaxed);
+  }
+
+  /** @brief Get the total statistics. */
+  static native_memory_stats statistics() noexcept {
+    return {
+      state().live_bytes.load(std::memory_order_relaxed),
+      state().live_objects.load(std::memory_order_relaxed),
+      state().since_gc.load(std::memory_order_relaxed),
+    };
+  }
+
+  /** @brief Get the first per-type account, see @ref account::next. */
+  static const account *accounts() noexcept {
+    return state().accounts.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Set the number of bytes allocated since the last garbage
+   * collection that triggers another, or 0 (the default) to never trigger it.
+   */
+  static void set_gc_threshold(size_t bytes) noexcept {
+    state().gc_threshold.store(bytes, std::memory_order_relaxed);
+  }
+
+  /** @brief Reset the count of bytes allocated since the last garbage collection. */
+  static void reset_since_gc() noexcept {
+    state().since_gc.store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Run `garbage-collect` if the GC threshold has been passed.
+   *
+   * This is called by every @ref module_function before it runs. A non-local
+   * exit from `garbage-collect` is left pending.
+   */
+  static void maybe_collect(envw nv) noexcept {
+    size_t threshold = state().gc_threshold.load(std::memory_order_relaxed);
+    if (!threshold || state().since_gc.load(std::memory_order_relaxed) < threshold) return;
+    reset_since_gc();
+    nv.funcall(nv.intern("garbage-collect"), 0, nullptr);
+  }
+
+private:
+  static const char *type_name(const std::type_info &type) noexcept {
+#ifdef __GNUG__
+    // intentionally leaked, this is once per type
+    int status = 0;
+    if (char *name = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status)) return name;
+#endif
+    return type.name();
+  }
+
+  struct totals {
+    std::atomic<size_t> live_bytes{0}, live_objects{0}, since_gc{0}, gc_threshold{0};
+    std::atomic<account *> accounts{nullptr};
+  };
+  static totals &state() noexcept {
+    static totals *instance = new totals();
+    return *instance;
+  }
+};
+
+namespace detail {
+template <typename T>
+inline void account_user_ptr(const T *, std::false_type, bool) noexcept {}
+template <typename T>
+inline void account_user_ptr(const T *ptr, std::true_type, bool alloc) noexcept {
+  if (!ptr) return;
+  size_t bytes = user_ptr_memory_size<T>::get(*ptr);
+  if (alloc) native_memory::allocated<T>(bytes);
+  else native_memory::freed<T>(bytes);
+}
+template <typename T>
+inline void account_user_ptr(const T *ptr, bool alloc) noexcept {
+  account_user_ptr(ptr, std::integral_constant<bool, user_ptr_memory_size<T>::enabled>{}, alloc);
+}
+
+// failing conversions of user-ptrs of the wrong type, for from_emacs and try_from_emacs
+[[noreturn]] inline void throw_user_ptr_mismatch() {
+  throw std::runtime_error("User ptr type mismatch");
+}
+inline bool fail_user_ptr_mismatch(envw nv, conversion_exit ex) noexcept {
+  if (ex == conversion_exit::keep) {
+    value msg = nv.make_string("User ptr type mismatch");
+    nv.non_local_exit_signal(nv.intern("error"), nv.funcall(nv.intern("list"), 1, &msg));
+  }
+  return false;
+}
+}
+
 /** @brief Type-safe Emacs user pointer representation. */
 template <typename T, typename Deleter = std::default_delete<T>>
 struct user_ptr {
@@ -66,6 +261,7 @@ public:
    * extracting (by comparing the function pointers).
    */
   static void fin(void *ptr) noexcept {
+    detail::account_user_ptr(reinterpret_cast<T*>(ptr), false);
     try {
       Deleter()(reinterpret_cast<T*>(ptr));
     } catch (...) {
@@ -88,6 +284,7 @@ public:
   friend value to_emacs(expected_type_t<user_ptr>, envw nv, const user_ptr &ptr) noexcept {
     value ret = nullptr;
     void *raw = reinterpret_cast<void*>(ptr.ptr);
+    detail::account_user_ptr(ptr.ptr, true);
     if (nv.non_local_exit_check()
         || (ret = nv.make_user_ptr(user_ptr<T, Deleter>::fin, raw),
             nv.non_local_exit_check())) {
@@ -109,10 +306,24 @@ public:
     emacs_finalizer fin = nv.get_user_finalizer(val);
     nv.maybe_non_local_exit();
     if (fin != user_ptr<T, Deleter>::fin) {
-      throw std::runtime_error("User ptr type mismatch");
+      detail::throw_user_ptr_mismatch();
     }
     return user_ptr<T, Deleter>(reinterpret_cast<T*>(nv.get_user_ptr(val)));
   }
+
+  /**
+   * @brief Try to convert a user_ptr from Emacs, as for @ref from_emacs().
+   * @see envw::try_extract()
+   */
+  friend bool try_from_emacs(expected_type_t<user_ptr>, envw nv, value val, user_ptr &out, conversion_exit ex) noexcept {
+    emacs_finalizer fin = nv.get_user_finalizer(val);
+    if (nv.non_local_exit_check()) return false;
+    if (fin != user_ptr<T, Deleter>::fin) {
+      return detail::fail_user_ptr_mismatch(nv, ex);
+    }
+    out = user_ptr<T, Deleter>(reinterpret_cast<T*>(nv.get_user_ptr(val)));
+    return true;
+  }
 };
 
 /**
@@ -129,6 +340,679 @@ public:
 template <typename T, typename...Args> inline user_ptr<T>
 make_user_ptr(Args &&...args) { return user_ptr<T>(new T(std::forward<Args>(args)...)); }
 
+/** @brief Allocation statistics of a pool, see @ref pooled_delete. */
+struct pool_stats {
+  /** @brief The size of each block, in bytes. */
+  size_t block_size;
+  /** @brief The number of slabs allocated from the heap. */
+  size_t slabs;
+  /** @brief The number of blocks in all slabs. */
+  size_t blocks_total;
+  /** @brief The number of blocks currently allocated. */
+  size_t blocks_in_use;
+  /** @brief The total number of allocations. */
+  size_t allocations;
+  /** @brief The total number of deallocations. */
+  size_t deallocations;
+
+  /** @brief The fraction of reserved blocks which are not in use, between 0 and 1. */
+  double fragmentation() const noexcept {
+    return blocks_total ? 1.0 - double(blocks_in_use) / double(blocks_total) : 0.0;
+  }
+};
+
+namespace detail {
+/**
+ * @brief A pool of fixed-size blocks, carved out of slabs which are kept for
+ * reuse until the program exits.
+ *
+ * There is one pool per size class, shared by all types of that size and
+ * alignment.
+ */
+template <size_t Size, size_t Align>
+struct size_class_pool {
+  /** @brief The size of each block, a multiple of the alignment. */
+  static constexpr size_t block_size = (Size + Align - 1) / Align * Align;
+
+  /** @brief Get the pool for this size class, which is never destroyed. */
+  static size_class_pool &get() noexcept {
+    static size_class_pool *instance = new size_class_pool();
+    return *instance;
+  }
+
+  /** @brief Allocate a block. @throws std::bad_alloc */
+  void *allocate() {
+    if (!free_list) grow();
+    free_block *blk = free_list;
+    free_list = blk->next;
+    ++stats.blocks_in_use;
+    ++stats.allocations;
+    return static_cast<void *>(blk);
+  }
+
+  /** @brief Return a block obtained from allocate(). */
+  void deallocate(void *ptr) noexcept {
+    free_block *blk = static_cast<free_block *>(ptr);
+    blk->next = free_list;
+    free_list = blk;
+    --stats.blocks_in_use;
+    ++stats.deallocations;
+  }
+
+  /** @brief Get the allocation statistics. */
+  pool_stats statistics() const noexcept { return stats; }
+
+private:
+  union free_block {
+    free_block *next;
+    alignas(Align) unsigned char storage[block_size];
+  };
+
+  struct slab {
+    slab *next;
+  };
+
+  // slabs hold at least 16 blocks, and are around 64KiB otherwise
+  static constexpr size_t blocks_per_slab =
+    65536 / sizeof(free_block) < 16 ? 16 : 65536 / sizeof(free_block);
+  static constexpr size_t header_size =
+    (sizeof(slab) + alignof(free_block) - 1) / alignof(free_block) * alignof(free_block);
+
+  free_block *free_list = nullptr;
+  slab *slabs = nullptr;
+  pool_stats stats{sizeof(free_block), 0, 0, 0, 0, 0};
+
+  size_class_pool() = default;
+
+  void grow() {
+    // operator new is suitably aligned for any fundamental alignment
+    static_assert(alignof(free_block) <= alignof(std::max_align_t),
+                  "Over-aligned types cannot be pooled");
+    unsigned char *mem = static_cast<unsigned char *>(
+      ::operator new(header_size + blocks_per_slab * sizeof(free_block)));
+    slabs = new (mem) slab{slabs};
+    free_block *blocks = reinterpret_cast<free_block *>(mem + header_size);
+    for (size_t i = blocks_per_slab; i-- > 0;) {
+      blocks[i].next = free_list;
+      free_list = &blocks[i];
+    }
+    ++stats.slabs;
+    stats.blocks_total += blocks_per_slab;
+  }
+};
+
+template <typename T>
+using pool_for = size_class_pool<sizeof(T), alignof(T)>;
+}
+
+/**
+ * @brief A @ref user_ptr `Deleter` which returns objects to a size-class
+ * pool, rather than the heap.
+ *
+ * Objects are allocated with make_pooled_user_ptr(), and the @ref
+ * user_ptr::fin() "finalizer" destroys them and returns their memory to the
+ * pool, saving a `malloc`/`free` pair for each object. This is worthwhile for
+ * modules which create many small objects.
+ *
+ * @warning The pools are not synchronized, they rely on Emacs' global lock.
+ * Only allocate pooled objects on threads with a live environment. For the
+ * same reason, this cannot be the `Deleter` of @ref background_delete, which
+ * rejects it.
+ *
+ * @see pooled_user_ptr
+ */
+template <typename T>
+struct pooled_delete {
+  /** @brief Destroy the object and return its memory to the pool. */
+  void operator()(T *ptr) const noexcept {
+    ptr->~T();
+    detail::pool_for<T>::get().deallocate(static_cast<void *>(ptr));
+  }
+
+  /** @brief Get the allocation statistics of `T`'s pool, which may be shared
+   * with other types of the same size and alignment. */
+  static pool_stats statistics() noexcept { return detail::pool_for<T>::get().statistics(); }
+};
+
+namespace detail {
+/** @brief Whether `Deleter` relies on Emacs' global lock, so must run on a thread with a live environment. */
+template <typename Deleter>
+struct deleter_needs_emacs_lock : std::false_type {};
+template <typename T>
+struct deleter_needs_emacs_lock<pooled_delete<T>> : std::true_type {};
+}
+
+/** @brief A @ref user_ptr to an object allocated from a pool. */
+template <typename T>
+using pooled_user_ptr = user_ptr<T, pooled_delete<T>>;
+
+/**
+ * @brief In-place construct a @ref pooled_user_ptr in its pool.
+ *
+ * This has the same caveats as make_user_ptr(), which it is otherwise
+ * interchangeable with, except that it must be extracted as a
+ * pooled_user_ptr.
+ */
+template <typename T, typename...Args> inline pooled_user_ptr<T>
+make_pooled_user_ptr(Args &&...args) {
+  auto &pool = detail::pool_for<T>::get();
+  void *mem = pool.allocate();
+  try {
+    return pooled_user_ptr<T>(new (mem) T(std::forward<Args>(args)...));
+  } catch (...) {
+    pool.deallocate(mem);
+    throw;
+  }
+}
+
+/**
+ * @brief Declares the base class of `T` for @ref tagged_user_ptr upcasts.
+ *
+ * Specialize this with a member `type` naming the direct base of `T` that
+ * tagged_user_ptr%s of `T` can be extracted as. The default, `void`, makes `T`
+ * a root. Only a single chain of bases is supported.
+ *
+ * @code{.cpp}
+ * template <> struct cppemacs::user_ptr_base<binary_node> { using type = ast_node; };
+ * @endcode
+ */
+template <typename T>
+struct user_ptr_base { using type = void; };
+
+namespace detail {
+struct tagged_header;
+
+/**
+ * @brief Compile-time type information for @ref tagged_user_ptr.
+ *
+ * `ancestors` is the chain of bases of the type, from the root to the type
+ * itself, so the type is a subtype of `B` exactly if `depth >= B.depth` and
+ * `ancestors[B.depth] == &B`.
+ */
+struct tagged_type_info {
+  /** @brief The number of bases of the type. */
+  size_t depth;
+  /** @brief The types of the chain, root first, of length `depth + 1`. */
+  const tagged_type_info *const *ancestors;
+  /** @brief Convert an object pointer to each type of the chain, as for ancestors. */
+  void *(*const *upcasts)(void *);
+  /** @brief Destroy an object of the type, and its header. */
+  void (*destroy)(tagged_header *hdr);
+};
+
+/** @brief The header of objects pointed to by a tagged `user-ptr`. */
+struct tagged_header {
+  /** @brief The type of the object. */
+  const tagged_type_info *type;
+  /** @brief The object, as its actual type. */
+  void *object;
+};
+
+template <typename T>
+struct tagged_box : tagged_header {
+  T obj;
+
+  template <typename...Args>
+  explicit tagged_box(Args &&...args): obj(std::forward<Args>(args)...) {}
+
+  static void destroy_box(tagged_header *hdr) {
+    try {
+      delete static_cast<tagged_box *>(hdr);
+    } catch (...) {
+      // deliberately dropped, this runs in a finalizer with nowhere to report to
+    }
+  }
+};
+
+template <typename...Ts> struct type_chain {};
+
+template <typename T, typename Base = typename user_ptr_base<T>::type>
+struct tagged_chain_of;
+template <typename T>
+struct tagged_chain_of<T, void> { using type = type_chain<T>; };
+template <typename T, typename Base>
+struct tagged_chain_of {
+  static_assert(std::is_base_of<Base, T>::value, "user_ptr_base<T> must be a base of T");
+  template <typename Chain> struct append;
+  template <typename...Ts> struct append<type_chain<Ts...>> { using type = type_chain<Ts..., T>; };
+  using type = typename append<typename tagged_chain_of<Base>::type>::type;
+};
+
+template <typename T> struct tagged_type;
+
+template <typename T, typename Chain = typename tagged_chain_of<T>::type>
+struct tagged_tables;
+template <typename T, typename...Ts>
+struct tagged_tables<T, type_chain<Ts...>> {
+  template <typename A>
+  static void *upcast(void *ptr) { return static_cast<void *>(static_cast<A *>(static_cast<T *>(ptr))); }
+
+  static constexpr size_t depth = sizeof...(Ts) - 1;
+  static const tagged_type_info *const ancestors[sizeof...(Ts)];
+  static void *(*const upcasts[sizeof...(Ts)])(void *);
+};
+template <typename T, typename...Ts>
+const tagged_type_info *const tagged_tables<T, type_chain<Ts...>>::ancestors[sizeof...(Ts)] = {
+  &tagged_type<Ts>::info...
+};
+template <typename T, typename...Ts>
+void *(*const tagged_tables<T, type_chain<Ts...>>::upcasts[sizeof...(Ts)])(void *) = {
+  &tagged_tables<T, type_chain<Ts...>>::template upcast<Ts>...
+};
+
+template <typename T>
+struct tagged_type {
+  static const tagged_type_info info;
+};
+template <typename T>
+const tagged_type_info tagged_type<T>::info = {
+  tagged_tables<T>::depth,
+  tagged_tables<T>::ancestors,
+  tagged_tables<T>::upcasts,
+  &tagged_box<T>::destroy_box,
+};
+
+/** @brief The finalizer shared by all tagged `user-ptr`s. */
+inline void tagged_fin(void *ptr) noexcept {
+  tagged_header *hdr = static_cast<tagged_header *>(ptr);
+  hdr->type->destroy(hdr);
+}
+}
+
+/**
+ * @brief A @ref user_ptr which can be extracted as any of its bases.
+ *
+ * Plain user_ptr%s are type-checked by their finalizer, so they can only be
+ * extracted as exactly the type they were created with. Objects created with
+ * make_tagged_user_ptr() are instead preceded by a header with their type,
+ * and all share a finalizer, so a tagged_user_ptr of a type can be extracted
+ * as a tagged_user_ptr of any base declared with @ref user_ptr_base. The type
+ * check is an integer and a pointer comparison, without RTTI.
+ *
+ * Ownership is as for user_ptr.
+ */
+template <typename T>
+struct tagged_user_ptr {
+private:
+  detail::tagged_header *hdr;
+  T *ptr;
+
+  tagged_user_ptr(detail::tagged_header *hdr, T *ptr) noexcept: hdr(hdr), ptr(ptr) {}
+
+  template <typename U, typename...Args>
+  friend tagged_user_ptr<U> make_tagged_user_ptr(Args &&...args);
+
+  static T *upcast(detail::tagged_header *hdr) noexcept {
+    const detail::tagged_type_info &want = detail::tagged_type<T>::info;
+    const detail::tagged_type_info &have = *hdr->type;
+    if (have.depth < want.depth || have.ancestors[want.depth] != &want) return nullptr;
+    return static_cast<T *>(have.upcasts[want.depth](hdr->object));
+  }
+
+public:
+  /** @brief Get the underlying pointer. */
+  T *get() const noexcept { return ptr; }
+  /** @brief Get the underlying pointer. */
+  T *operator->() const noexcept { return ptr; }
+  /** @brief Dereference the pointer. */
+  T &operator*() const noexcept { return *ptr; }
+
+  /**
+   * @brief Convert to Emacs, with the GC becoming responsible for the object.
+   *
+   * As for @ref user_ptr, the object is destroyed immediately if this fails.
+   * @pre The pointer must be owned by us, see @ref user_ptr.
+   */
+  friend value to_emacs(expected_type_t<tagged_user_ptr>, envw nv, const tagged_user_ptr &p) noexcept {
+    value ret = nullptr;
+    if (nv.non_local_exit_check()
+        || (ret = nv.make_user_ptr(&detail::tagged_fin, static_cast<void *>(p.hdr)),
+            nv.non_local_exit_check())) {
+      detail::tagged_fin(p.hdr);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Convert from a tagged `user-ptr` of `T` or a type derived from it,
+   * with the GC still responsible for the object.
+   */
+  friend tagged_user_ptr from_emacs(expected_type_t<tagged_user_ptr>, envw nv, value val) {
+    tagged_user_ptr ret(nullptr, nullptr);
+    if (!try_from_emacs(expected_type_t<tagged_user_ptr>{}, nv, val, ret, conversion_exit::keep)) {
+      nv.maybe_non_local_exit();
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Try to convert from Emacs, as for @ref from_emacs().
+   * @see envw::try_extract()
+   */
+  friend bool try_from_emacs(expected_type_t<tagged_user_ptr>, envw nv, value val, tagged_user_ptr &out, conversion_exit ex) noexcept {
+    emacs_finalizer f = nv.get_user_finalizer(val);
+    if (nv.non_local_exit_check()) return false;
+    detail::tagged_header *hdr = nullptr;
+    T *obj = nullptr;
+    if (f == &detail::tagged_fin) {
+      hdr = static_cast<detail::tagged_header *>(nv.get_user_ptr(val));
+      obj = upcast(hdr);
+    }
+    if (!obj) {
+      return detail::fail_user_ptr_mismatch(nv, ex);
+    }
+    out = tagged_user_ptr(hdr, obj);
+    return true;
+  }
+};
+
+/**
+ * @brief In-place construct a @ref tagged_user_ptr on the heap, with its
+ * type header.
+ *
+ * This has the same caveats as make_user_ptr().
+ */
+template <typename T, typename...Args>
+inline tagged_user_ptr<T> make_tagged_user_ptr(Args &&...args) {
+  auto box = new detail::tagged_box<T>(std::forward<Args>(args)...);
+  box->type = &detail::tagged_type<T>::info;
+  box->object = static_cast<void *>(&box->obj);
+  return tagged_user_ptr<T>(box, &box->obj);
+}
+
+namespace detail {
+/**
+ * @brief The single allocation behind a @ref shared_user_ptr: the object,
+ * next to the `std::shared_ptr` control block from `std::make_shared`.
+ */
+template <typename T>
+struct shared_user_box {
+  /** @brief The shared object. */
+  T obj;
+  /** @brief The number of Emacs values referring to this box. */
+  size_t emacs_refs = 0;
+  /** @brief The strong reference held on behalf of Emacs, while emacs_refs is non-zero. */
+  std::shared_ptr<shared_user_box> self;
+
+  /** @brief Construct the object from `args`. */
+  template <typename...Args>
+  explicit shared_user_box(Args &&...args): obj(std::forward<Args>(args)...) {}
+};
+}
+
+/**
+ * @brief A shared pointer which can be passed to Emacs as a `user-ptr`,
+ * sharing ownership with the garbage collector.
+ *
+ * Unlike a `user_ptr<std::shared_ptr<T>>`, the object and its reference counts
+ * are in a single allocation (made by make_shared_user_ptr()), the `user-ptr`
+ * points directly at it, and converting to and from Emacs allocates nothing.
+ * shared() gives a `std::shared_ptr<T>` to the same object, which can be
+ * handed to other threads.
+ *
+ * @warning Conversions to and from Emacs, like all Emacs calls, must happen
+ * on threads with a live environment. Copies of the pointer may be used and
+ * dropped from any thread.
+ */
+template <typename T>
+struct shared_user_ptr {
+private:
+  using box = detail::shared_user_box<T>;
+  std::shared_ptr<box> ptr;
+
+  explicit shared_user_ptr(std::shared_ptr<box> ptr) noexcept: ptr(std::move(ptr)) {}
+
+  template <typename U, typename...Args>
+  friend shared_user_ptr<U> make_shared_user_ptr(Args &&...args);
+
+public:
+  /** @brief Construct a null pointer. */
+  shared_user_ptr() noexcept = default;
+
+  /** @brief Get the underlying pointer. */
+  T *get() const noexcept { return ptr ? &ptr->obj : nullptr; }
+  /** @brief Get the underlying pointer. */
+  T *operator->() const noexcept { return get(); }
+  /** @brief Dereference the pointer. */
+  T &operator*() const noexcept { return ptr->obj; }
+  /** @brief Check whether the pointer is non-null. */
+  explicit operator bool() const noexcept { return ptr != nullptr; }
+  /** @brief Get the number of owners, with all Emacs values counting as one. */
+  long use_count() const noexcept { return ptr.use_count(); }
+
+  /** @brief Get a `std::shared_ptr` sharing ownership of the object, without allocating. */
+  std::shared_ptr<T> shared() const noexcept { return std::shared_ptr<T>(ptr, get()); }
+  /** @brief Get a `std::shared_ptr` sharing ownership of the object, without allocating. */
+  operator std::shared_ptr<T>() const noexcept { return shared(); }
+
+  /**
+   * @brief The finalizer for these pointers, which releases Emacs' ownership
+   * once no Emacs values refer to the object.
+   *
+   * This is also used for type-checking, as for @ref user_ptr::fin().
+   */
+  static void fin(void *raw) noexcept {
+    box *b = static_cast<box *>(raw);
+    if (--b->emacs_refs == 0) {
+      // the box may be destroyed with this
+      std::shared_ptr<box> released = std::move(b->self);
+    }
+  }
+
+  /**
+   * @brief Convert to an Emacs `user-ptr`, which shares ownership of the
+   * object. A null pointer is converted to `nil`.
+   */
+  friend value to_emacs(expected_type_t<shared_user_ptr>, envw nv, const shared_user_ptr &p) noexcept {
+    if (!p.ptr) return nv.intern("nil");
+    value ret = nv.make_user_ptr(&fin, static_cast<void *>(p.ptr.get()));
+    if (!nv.non_local_exit_check() && p.ptr->emacs_refs++ == 0) {
+      p.ptr->self = p.ptr;
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Convert from an Emacs `user-ptr` made from a shared_user_ptr of
+   * the same type, sharing ownership of the object.
+   */
+  friend shared_user_ptr from_emacs(expected_type_t<shared_user_ptr>, envw nv, value val) {
+    emacs_finalizer f = nv.get_user_finalizer(val);
+    nv.maybe_non_local_exit();
+    if (f != &fin) {
+      detail::throw_user_ptr_mismatch();
+    }
+    return shared_user_ptr(static_cast<box *>(nv.get_user_ptr(val))->self);
+  }
+
+  /**
+   * @brief Try to convert from Emacs, as for @ref from_emacs().
+   * @see envw::try_extract()
+   */
+  friend bool try_from_emacs(expected_type_t<shared_user_ptr>, envw nv, value val, shared_user_ptr &out, conversion_exit ex) noexcept {
+    emacs_finalizer f = nv.get_user_finalizer(val);
+    if (nv.non_local_exit_check()) return false;
+    if (f != &fin) {
+      return detail::fail_user_ptr_mismatch(nv, ex);
+    }
+    out = shared_user_ptr(static_cast<box *>(nv.get_user_ptr(val))->self);
+    return true;
+  }
+};
+
+/**
+ * @brief Construct a @ref shared_user_ptr, in a single allocation.
+ *
+ * Unlike make_user_ptr(), the result does not leak if it is never passed to
+ * Emacs.
+ */
+template <typename T, typename...Args>
+inline shared_user_ptr<T> make_shared_user_ptr(Args &&...args) {
+  return shared_user_ptr<T>(std::make_shared<detail::shared_user_box<T>>(std::forward<Args>(args)...));
+}
+
+namespace detail {
+/**
+ * @brief Global references whose owners were destroyed, waiting to be freed.
+ *
+ * Destructors can run without a live environment (in @ref user_ptr::fin()
+ * "finalizers", on other threads, or during static destruction), so they only
+ * push the reference here. This is a lock-free stack: any thread can push, and
+ * the whole stack is taken at once and freed in a batch the next time an
+ * environment is at hand, such as when a @ref module_function is invoked.
+ */
+struct global_ref_graveyard {
+  /** @brief Get the graveyard, which is never destroyed. */
+  static global_ref_graveyard &get() noexcept {
+    static global_ref_graveyard *instance = new global_ref_graveyard();
+    return *instance;
+  }
+
+  /** @brief Queue a reference to be freed. */
+  void bury(value ref) noexcept {
+    node *n = new (std::nothrow) node{ref, head.load(std::memory_order_relaxed)};
+    if (!n) return; // leak it rather than terminate
+    while (!head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  /** @brief Check whether no references are queued. */
+  bool empty() const noexcept { return !head.load(std::memory_order_relaxed); }
+
+  /** @brief Free all the queued references, unless a non-local exit is pending. */
+  void collect(envw nv) noexcept {
+    if (!head.load(std::memory_order_relaxed)) return;
+    if (nv.non_local_exit_check()) return; // the frees would be ignored
+    node *n = head.exchange(nullptr, std::memory_order_acquire);
+    while (n) {
+      node *next = n->next;
+      nv.free_global_ref(n->ref);
+      delete n;
+      n = next;
+    }
+  }
+
+private:
+  struct node {
+    value ref;
+    node *next;
+  };
+  std::atomic<node *> head{nullptr};
+};
+}
+
+/**
+ * @brief An owning, move-only handle to a global reference.
+ *
+ * The reference is freed when the handle is destroyed. Since there may be no
+ * live environment then, it is queued and freed in a batch by the next
+ * global_ref created, the next @ref module_function call, or collect(). So
+ * destroying a global_ref is cheap and safe from any thread, including in
+ * finalizers and during static destruction, and global_refs can be held by
+ * objects owned by a @ref user_ptr.
+ *
+ * @code{.cpp}
+ * static global_ref cache;
+ * cache = global_ref(env, env.intern("my-module-cache"));
+ * env.funcall(cache, {});
+ * @endcode
+ *
+ * @see global_cell
+ */
+struct global_ref {
+private:
+  value ref = nullptr;
+
+public:
+  /** @brief Construct an empty handle. */
+  global_ref() noexcept = default;
+
+  /**
+   * @brief Make a global reference to `val`.
+   *
+   * This also frees any references queued by destroyed handles. If a
+   * non-local exit is pending, the handle is empty.
+   */
+  global_ref(envw nv, value val) noexcept {
+    collect(nv);
+    if (!nv.non_local_exit_check()) ref = nv.make_global_ref(val);
+  }
+
+  global_ref(const global_ref &) = delete;
+  global_ref &operator=(const global_ref &) = delete;
+
+  /** @brief Take ownership of `o`'s reference. */
+  global_ref(global_ref &&o) noexcept : ref(o.release()) {}
+  /** @brief Take ownership of `o`'s reference, queueing the current one to be freed. */
+  global_ref &operator=(global_ref &&o) noexcept {
+    if (this != &o) {
+      value old = ref;
+      ref = o.release();
+      if (old) detail::global_ref_graveyard::get().bury(old);
+    }
+    return *this;
+  }
+
+  /** @brief Queue the reference to be freed. */
+  ~global_ref() {
+    if (ref) detail::global_ref_graveyard::get().bury(ref);
+  }
+
+  /** @brief Get the reference, or null if empty. */
+  value get() const noexcept { return ref; }
+  /** @brief Get the reference, or null if empty. */
+  operator value() const noexcept { return ref; }
+  /** @brief Check whether this handle is non-empty. */
+  explicit operator bool() const noexcept { return ref != nullptr; }
+
+  /** @brief Give up ownership of the reference, leaving the handle empty. */
+  value release() noexcept {
+    value ret = ref;
+    ref = nullptr;
+    return ret;
+  }
+
+  /** @brief Free the reference immediately, leaving the handle empty. */
+  void reset(envw nv) noexcept {
+    if (ref) nv.free_global_ref(release());
+  }
+
+  /**
+   * @brief Free the references queued by destroyed handles.
+   *
+   * This does nothing while a non-local exit is pending, since Emacs would
+   * ignore the frees.
+   */
+  static void collect(envw nv) noexcept {
+    detail::global_ref_graveyard::get().collect(nv);
+  }
+
+  /** @brief Convert to the referenced value. */
+  friend value to_emacs(expected_type_t<global_ref>, envw, const global_ref &r) noexcept { return r.ref; }
+};
+
+/**
+ * @brief A @ref global_ref that can be used as a @ref cell in an environment.
+ *
+ * @code{.cpp}
+ * global_cell hook(env, env.intern("my-module-hook"));
+ * // later, in another call
+ * hook.in(env)(1, 2);
+ * @endcode
+ */
+struct global_cell : global_ref {
+  using global_ref::global_ref;
+  /** @brief Construct an empty handle. */
+  global_cell() noexcept = default;
+  /** @brief Make a global reference to `val`, see @ref global_ref::global_ref(envw, value). */
+  explicit global_cell(const cell &val) noexcept : global_ref(val.env(), val) {}
+
+  /** @brief Get a cell for the referenced value in `nv`. */
+  cell in(envw nv) const noexcept { return cell(nv, get()); }
+
+  /** @brief Convert to the referenced value. */
+  friend value to_emacs(expected_type_t<global_cell>, envw, const global_cell &r) noexcept { return r.get(); }
+};
+
 CPPEMACS_SUPPRESS_WCOMPAT_MANGLING_BEGIN
 /**
  * @brief Data representation for storing C++ functions in Emacs
@@ -303,6 +1187,9 @@ struct module_function {
   /** @brief An @ref cppemacs::emacs_function "emacs_function" which
    * converts @e data to `F` and invokes it. */
   static value invoke(emacs_env *nv, ptrdiff_t nargs, value *args, void *data) noexcept {
+    env_call_scope scope;
+    global_ref::collect(nv);
+    native_memory::maybe_collect(nv);
     return envw(nv).run_catching(
       [&]() noexcept(
         noexcept(value(data_repr::extract(data)(nv, nargs, args)))
@@ -363,11 +1250,201 @@ template <typename F> auto make_module_function(
 #if !CPPEMACS_HAVE_RETURN_TYPE_DEDUCTION
   -> module_function<detail::remove_reference_t<F>>
 #endif
-{
-  return module_function<detail::remove_reference_t<F>>(
-    min_arity, max_arity, doc,
-    std::forward<F>(f));
-}
+{
+  return module_function<detail::remove_reference_t<F>>(
+    min_arity, max_arity, doc,
+    std::forward<F>(f));
+}
+
+/**
+ * @brief Either a `T`, or a `signal` or `throw` to raise instead, without
+ * throwing a C++ exception.
+ *
+ * When this is @ref cppemacs_conversions "converted" to Emacs, such as when
+ * it is returned from a @link make_spreader_function() spreader function
+ * @endlink or @link make_typed_function() typed function @endlink, the held
+ * `T` is converted as usual, or the non-local exit is raised directly with
+ * envw::non_local_exit_signal() or envw::non_local_exit_throw().
+ *
+ * This is cheaper than throwing @ref signalled, for functions which fail
+ * often, since no stack unwinding is involved.
+ *
+ * @code
+ * env->*make_typed_function(
+ *   "Return X if it is positive.\n\n(fn X)",
+ *   [](envw env, int x) -> signal_or<int> {
+ *     if (x <= 0) return error_signal(env, "Not positive");
+ *     return x;
+ *   });
+ * @endcode
+ */
+template <typename T>
+struct signal_or {
+  static_assert(!std::is_reference<T>::value, "Must not be a reference type");
+private:
+  emacs_funcall_exit exit;
+  value symbol, data;
+  union { T val; };
+
+  void destroy() noexcept { if (ok()) val.~T(); }
+  template <typename U> void assign(U &&o) {
+    exit = o.exit; symbol = o.symbol; data = o.data;
+    if (o.ok()) new (&val) T(std::forward<U>(o).val);
+  }
+
+public:
+  /** @brief Hold a `T`, constructed from `arg`. */
+  template <typename U, detail::enable_if_t<
+              std::is_constructible<T, U &&>::value
+              // don't take over copies, or signals (bool is constructible from these)
+              && !std::is_same<detail::decay_t<U>, signal_or>::value
+              && !std::is_same<detail::decay_t<U>, signalled>::value
+              && !std::is_same<detail::decay_t<U>, thrown>::value, int> = 0>
+  signal_or(U &&arg) noexcept(std::is_nothrow_constructible<T, U &&>::value)
+    : exit(emacs_funcall_exit_return), symbol(), data(), val(std::forward<U>(arg)) {}
+  /** @brief Hold a `signal` to raise. */
+  signal_or(const signalled &sig) noexcept
+    : exit(emacs_funcall_exit_signal), symbol(sig.symbol), data(sig.data) {}
+  /** @brief Hold a `throw` to raise. */
+  signal_or(const thrown &thr) noexcept
+    : exit(emacs_funcall_exit_throw), symbol(thr.symbol), data(thr.data) {}
+
+  /** @brief Copy constructor. */
+  signal_or(const signal_or &o) { assign(o); }
+  /** @brief Move constructor. */
+  signal_or(signal_or &&o) noexcept(std::is_nothrow_move_constructible<T>::value)
+  { assign(std::move(o)); }
+  /** @brief Copy assignment. */
+  signal_or &operator=(const signal_or &o) {
+    if (this != &o) { destroy(); assign(o); }
+    return *this;
+  }
+  /** @brief Move assignment. */
+  signal_or &operator=(signal_or &&o) noexcept(std::is_nothrow_move_constructible<T>::value) {
+    if (this != &o) { destroy(); assign(std::move(o)); }
+    return *this;
+  }
+  ~signal_or() { destroy(); }
+
+  /** @brief Whether this holds a `T`. */
+  bool ok() const noexcept { return exit == emacs_funcall_exit_return; }
+  /** @brief Whether this holds a `T`. */
+  explicit operator bool() const noexcept { return ok(); }
+  /** @brief Get the held `T`. @pre ok() */
+  T &get() noexcept { assert(ok()); return val; }
+  /** @brief Get the held `T`. @pre ok() */
+  const T &get() const noexcept { assert(ok()); return val; }
+
+  /** @brief Convert the held `T`, or raise the non-local exit and return `nil`. */
+  friend value to_emacs(expected_type_t<signal_or>, envw nv, signal_or &&r) {
+    if (r.ok()) return nv->*std::move(r.val);
+    r.raise(nv);
+    return nv.intern("nil");
+  }
+  /** @brief Convert the held `T`, or raise the non-local exit and return `nil`. */
+  friend value to_emacs(expected_type_t<signal_or>, envw nv, const signal_or &r) {
+    if (r.ok()) return nv->*r.val;
+    r.raise(nv);
+    return nv.intern("nil");
+  }
+
+private:
+  void raise(envw nv) const noexcept {
+    if (exit == emacs_funcall_exit_signal) nv.non_local_exit_signal(symbol, data);
+    else nv.non_local_exit_throw(symbol, data);
+  }
+};
+
+/**
+ * @brief Construct an `error` signal with `message`, like Lisp <code>(error
+ * message)</code>, but without formatting.
+ *
+ * This does not throw, so it can be returned as a @ref signal_or.
+ */
+inline signalled error_signal(envw nv, const char *message) noexcept {
+  value msg = nv.make_string(message);
+  return signalled(nv.intern("error"), nv.funcall(nv.intern("list"), 1, &msg));
+}
+
+#if (EMACS_MAJOR_VERSION >= 26)
+/**
+ * @brief Checks for quits from long-running loops, at roughly fixed intervals.
+ *
+ * Checking for a quit every iteration is expensive, so tick() only counts down
+ * a stride of iterations. When it reaches zero the quit is checked, and the
+ * stride is adjusted so that checks happen about once per `interval`.
+ *
+ * Quits are checked with @ref envw::process_input() from Emacs 27, and with
+ * @ref envw::should_quit() before that. If the user has quit, the `quit` signal
+ * is raised with @ref envw::maybe_non_local_exit().
+ *
+ * @code{.cpp}
+ * quit_checker quit(env);
+ * for (auto &entry : entries) {
+ *   quit.tick();
+ *   // ...
+ * }
+ * @endcode
+ */
+class quit_checker {
+public:
+  /** @brief The clock used to measure intervals. */
+  using clock = std::chrono::steady_clock;
+  /** @brief The largest number of iterations between checks. */
+  static constexpr size_t max_stride = size_t(1) << 24;
+
+  /** @brief Check for quits in `nv`, about once every `interval`. */
+  explicit quit_checker(envw nv, std::chrono::nanoseconds interval = std::chrono::milliseconds(10)) noexcept
+    : nv(nv), interval(interval), stride(1), countdown(1), last(clock::now()) {}
+
+  /**
+   * @brief Count `n` iterations, and check for a quit if one is due.
+   * @throws non_local_exit (or as configured by @ref
+   * CPPEMACS_DEFAULT_EXCEPTION_BOXER) if the user has quit.
+   */
+  void tick(size_t n = 1) {
+    if (countdown > n) countdown -= n;
+    else check();
+  }
+
+  /**
+   * @brief Check for a quit now, and adjust the stride.
+   * @throws non_local_exit (or as configured by @ref
+   * CPPEMACS_DEFAULT_EXCEPTION_BOXER) if the user has quit.
+   */
+  void check() {
+    clock::time_point now = clock::now();
+    double elapsed = double(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count());
+    double target = double(stride) * double(interval.count()) / (elapsed > 1 ? elapsed : 1);
+    // grow gradually, since one sample is noisy, but shrink at once
+    double grown = double(stride) * 8;
+    if (target > grown) target = grown;
+    if (target > double(max_stride)) target = double(max_stride);
+    stride = target < 1 ? 1 : size_t(target);
+    countdown = stride;
+    last = now;
+
+#if (EMACS_MAJOR_VERSION >= 27)
+    bool quit = nv.process_input() == process_input_result::quit_;
+#else
+    bool quit = nv.should_quit();
+#endif
+    if (quit) {
+      if (!nv.non_local_exit_check()) nv.non_local_exit_signal(nv.intern("quit"), nv.intern("nil"));
+      nv.maybe_non_local_exit();
+    }
+  }
+
+  /** @brief Get the number of iterations between checks. */
+  size_t current_stride() const noexcept { return stride; }
+
+private:
+  envw nv;
+  std::chrono::nanoseconds interval;
+  size_t stride, countdown;
+  clock::time_point last;
+};
+#endif
 
 /**
  * @brief Used to provide a span-like argument to a @link
@@ -383,11 +1460,13 @@ template <typename F> auto make_module_function(
  */
 struct spreader_restargs {
 private:
-  value *args; size_t nargs;
+  value *args; size_t nargs; emacs_env *nv;
 
 public:
-  /** @brief Construct from a pointer and length. */
-  spreader_restargs(value *args, size_t nargs) : args(args), nargs(nargs) {}
+  /** @brief Construct from a pointer and length, and optionally the
+   * environment the arguments belong to. */
+  spreader_restargs(value *args, size_t nargs, emacs_env *nv = nullptr)
+    : args(args), nargs(nargs), nv(nv) {}
 
   /** @brief Convert this to `T` with a <code>(::value *begin, ::value
       *end)</code> constructor. */
@@ -395,6 +1474,17 @@ public:
             <std::is_constructible<T, value *, value *>::value, int> = 0>
   operator T() const { return {begin(), end()}; }
 
+  /** @brief Convert this to `T` with a <code>(@ref envw, @ref
+      spreader_restargs)</code> constructor, such as @ref keyword_args.
+      @pre The environment was provided. */
+  template <typename T, detail::enable_if_t
+            <!std::is_constructible<T, value *, value *>::value
+             && std::is_constructible<T, envw, spreader_restargs>::value, long> = 0>
+  operator T() const { return T(env(), *this); }
+
+  /** @brief Get the environment, which may be null. */
+  envw env() const { return nv; }
+
   /** @brief Get the argument pointer. */
   value *data() const { return args; }
   /** @brief Get the argument pointer. */
@@ -429,20 +1519,21 @@ template <bool IsVar, typename SI> struct spreader_caller;
 template <typename SI> struct spreader_caller<false, SI> {
   template <size_t NArgs, size_t...Idx> static value
   invoke_with_arity(detail::index_sequence<Idx...>, SI &si, envw nv, value *args) noexcept(false)
-  { return si.asserted_call(nv, arg_or_default<Idx < NArgs>(nv, args, Idx)...); }
+  { (void)args; return si.asserted_call(nv, arg_or_default<Idx < NArgs>(nv, args, Idx)...); }
   template <size_t CallArity, size_t...Idx> static value
   invoke_variadic(detail::index_sequence<Idx...>, SI &, envw, ptrdiff_t, value *) noexcept(false) { return {}; }
 };
 template <typename SI> struct spreader_caller<true, SI> {
   template <size_t NArgs, size_t...Idx> static value
   invoke_with_arity(detail::index_sequence<Idx...>, SI &si, envw nv, value *args) noexcept(false) {
+    (void)args;
     return si.asserted_call(nv, arg_or_default<Idx < NArgs>(nv, args, Idx)...,
-                            spreader_restargs(nullptr, 0));
+                            spreader_restargs(nullptr, 0, nv));
   }
   template <size_t CallArity, size_t...Idx> static value
   invoke_variadic(detail::index_sequence<Idx...>, SI &si, envw nv, ptrdiff_t nargs, value *args) noexcept(false) {
     return si.asserted_call(nv, arg_or_default<true>(nv, args, Idx)...,
-                            spreader_restargs(args + CallArity, nargs - CallArity));
+                            spreader_restargs(args + CallArity, nargs - CallArity, nv));
   }
 };
 
@@ -471,35 +1562,35 @@ private:
     return nv->*ret;
   }
 
-  template <size_t Arity>
-  static value vt_fun(spread_invoker *self, envw nv, value *args)
-  { return caller::template invoke_with_arity<Arity>(arity_seq(), *self, nv, args); }
-  using vt_funtype = value (*)(spread_invoker *, envw, value *);
+  // nargs is known to be MaxArity here
+  template <ptrdiff_t Arity, detail::enable_if_t<(Arity >= MaxArity), bool> = true>
+  value dispatch(envw nv, ptrdiff_t, value *args) noexcept(false)
+  { return caller::template invoke_with_arity<MaxArity>(arity_seq(), *this, nv, args); }
 
-  template <size_t...OffIdx>
-  value invoke(
-    detail::index_sequence<OffIdx...>,
-    envw nv, ptrdiff_t nargs, value *args
-  ) noexcept(false) {
+  // compare against each arity in turn, which compilers fold into a
+  // switch, or into nothing at all for fixed-arity functions
+  template <ptrdiff_t Arity, detail::enable_if_t<(Arity < MaxArity), bool> = true>
+  value dispatch(envw nv, ptrdiff_t nargs, value *args) noexcept(false) {
+    if (nargs == Arity) {
+      return caller::template invoke_with_arity<Arity>(arity_seq(), *this, nv, args);
+    }
+    return dispatch<Arity + 1>(nv, nargs, args);
+  }
+
+public:
+  /**
+   * @brief Call the underlying function with the given arguments.
+   *
+   * This may throw, exceptions are caught by @ref module_function::invoke().
+   */
+  value operator()(envw nv, ptrdiff_t nargs, value *args) noexcept(false) {
     if (IsVariadic && nargs > MaxArity) {
       return caller::template invoke_variadic<MaxArity>(arity_seq(), *this, nv, nargs, args);
     } else if (nargs < MinArity || nargs > MaxArity) {
       // should have been caught by Emacs
       throw std::runtime_error("Bad arity");
-    } else {
-      static constexpr vt_funtype Vt[] = { &spread_invoker::vt_fun<MinArity + OffIdx> ... };
-      return Vt[nargs - MinArity](this, nv, args);
     }
-  }
-
-public:
-  /** @brief Call the underlying function with the given arguments. */
-  value operator()(envw nv, ptrdiff_t nargs, value *args) noexcept {
-    return nv.run_catching([&]() -> value {
-      return invoke(
-        detail::make_index_sequence<MaxArity - MinArity + 1>(),
-        nv, nargs, args);
-    });
+    return dispatch<MinArity>(nv, nargs, args);
   }
 };
 }
@@ -553,6 +1644,9 @@ using spreader_variadic = spreader_arity<MinArity, CallArity, true>;
  * @see cell_extracted, which automatically converts function arguments to the
  * desired type.
  *
+ * @see make_typed_function(), which deduces the arity and conversions from the
+ * signature of `f` instead.
+ *
  * @b Examples
  *
  * @snippet utils_examples.cpp Spreader Functions
@@ -577,6 +1671,698 @@ auto make_spreader_function(
     detail::remove_reference_t<F>>(std::forward<F>(f)));
 }
 
+namespace detail {
+/** @brief The call signature `R(Args...)` of a function, function pointer, or
+ * object with a single non-template `operator()`. */
+template <typename F> struct callable_signature
+  : callable_signature<decltype(&F::operator())> {};
+template <typename R, typename...Args>
+struct callable_signature<R(Args...)> { using type = R(Args...); };
+template <typename R, typename...Args>
+struct callable_signature<R(*)(Args...)> : callable_signature<R(Args...)> {};
+template <typename C, typename R, typename...Args>
+struct callable_signature<R(C::*)(Args...)> : callable_signature<R(Args...)> {};
+template <typename C, typename R, typename...Args>
+struct callable_signature<R(C::*)(Args...) const> : callable_signature<R(Args...)> {};
+#ifdef __cpp_noexcept_function_type
+template <typename R, typename...Args>
+struct callable_signature<R(*)(Args...) noexcept> : callable_signature<R(Args...)> {};
+template <typename C, typename R, typename...Args>
+struct callable_signature<R(C::*)(Args...) noexcept> : callable_signature<R(Args...)> {};
+template <typename C, typename R, typename...Args>
+struct callable_signature<R(C::*)(Args...) const noexcept> : callable_signature<R(Args...)> {};
+#endif
+
+/**
+ * @brief How a parameter of a @link make_typed_function() typed function
+ * @endlink is filled.
+ *
+ * Parameters are required by default, `std::optional<T>` parameters are
+ * `&optional`, and a trailing @ref spreader_restargs receives `&rest`.
+ */
+template <typename T> struct typed_parameter {
+  /** @brief Whether this is an `&optional` parameter. */
+  static constexpr bool is_optional = false;
+  /** @brief Whether this is a `&rest` parameter. */
+  static constexpr bool is_rest = false;
+};
+template <> struct typed_parameter<spreader_restargs> {
+  static constexpr bool is_optional = false;
+  static constexpr bool is_rest = true;
+};
+#ifdef CPPEMACS_HAVE_OPTIONAL
+template <typename T> struct typed_parameter<std::optional<T>> {
+  static constexpr bool is_optional = true;
+  static constexpr bool is_rest = false;
+};
+#endif
+
+template <bool IsOptional, bool IsRest> struct typed_arg;
+template <> struct typed_arg<false, false> {
+  template <typename T> static T get(envw nv, ptrdiff_t, value *args, size_t idx)
+  { return nv.extract<T>(args[idx]); }
+};
+template <> struct typed_arg<true, false> {
+  // as in Lisp, a nil argument is the same as an absent one
+  template <typename T> static T get(envw nv, ptrdiff_t nargs, value *args, size_t idx) {
+    if (ptrdiff_t(idx) >= nargs || !nv.is_not_nil(args[idx])) return T();
+    return T(nv.extract<typename T::value_type>(args[idx]));
+  }
+};
+template <> struct typed_arg<false, true> {
+  template <typename T> static T get(envw nv, ptrdiff_t nargs, value *args, size_t idx) {
+    return ptrdiff_t(idx) < nargs
+      ? T(spreader_restargs(args + idx, nargs - idx, nv))
+      : T(spreader_restargs(nullptr, 0, nv));
+  }
+};
+
+constexpr size_t count_leading(size_t n) { return n; }
+template <typename...Bs> constexpr size_t count_leading(size_t n, bool b, Bs...bs)
+{ return b ? count_leading(n + 1, bs...) : n; }
+constexpr size_t count_true() { return 0; }
+template <typename...Bs> constexpr size_t count_true(bool b, Bs...bs)
+{ return size_t(b) + count_true(bs...); }
+
+/** @brief The arity of a @link make_typed_function() typed function @endlink
+ * with (decayed) parameter types `Args`. */
+template <typename...Args> struct typed_arity {
+  /** @brief The number of required parameters. */
+  static constexpr size_t required =
+    count_leading(0, (!typed_parameter<Args>::is_optional && !typed_parameter<Args>::is_rest)...);
+  /** @brief The number of required and optional parameters. */
+  static constexpr size_t positional = count_true(!typed_parameter<Args>::is_rest...);
+  /** @brief Whether there is a rest parameter. */
+  static constexpr bool is_variadic = positional != sizeof...(Args);
+
+  static_assert(positional + 1 >= sizeof...(Args)
+                && count_leading(0, !typed_parameter<Args>::is_rest...) == positional,
+                "A rest parameter must be the last parameter");
+  static_assert(required + count_true(typed_parameter<Args>::is_optional...) == positional,
+                "Required parameters cannot follow optional parameters");
+};
+
+template <typename Ret> struct typed_return {
+  template <typename F, typename...Args>
+  static value call(envw nv, F &f, Args &&...args)
+  { return nv->*f(std::forward<Args>(args)...); }
+};
+template <> struct typed_return<void> {
+  template <typename F, typename...Args>
+  static value call(envw nv, F &f, Args &&...args) {
+    f(std::forward<Args>(args)...);
+    return nv.intern("nil");
+  }
+};
+
+/**
+ * @brief A wrapper over F that adapts it to an @ref module_function style
+ * callable, converting arguments to `Args`.
+ *
+ * @see make_typed_function()
+ */
+template <typename F, typename Ret, bool TakesEnv, typename...Args>
+struct typed_invoker {
+  /** @brief The underlying function. */
+  F f;
+  /** @brief Construct F from a forwarded argument. */
+  template <typename Arg>
+  typed_invoker(Arg &&arg): f(std::forward<Arg>(arg)) {}
+
+  /** @brief The arity of the function. */
+  using arity = typed_arity<Args...>;
+
+private:
+  template <typename T> static T get_arg(envw nv, ptrdiff_t nargs, value *args, size_t idx) {
+    using param = typed_parameter<T>;
+    return typed_arg<param::is_optional, param::is_rest>::template get<T>(nv, nargs, args, idx);
+  }
+
+  template <size_t...Idx>
+  value call(std::true_type, index_sequence<Idx...>, envw nv, std::tuple<Args...> &targs)
+  { return typed_return<Ret>::call(nv, f, nv, std::move(std::get<Idx>(targs))...); }
+  template <size_t...Idx>
+  value call(std::false_type, index_sequence<Idx...>, envw nv, std::tuple<Args...> &targs)
+  { (void)targs; return typed_return<Ret>::call(nv, f, std::move(std::get<Idx>(targs))...); }
+
+  template <size_t...Idx>
+  value invoke(index_sequence<Idx...> seq, envw nv, ptrdiff_t nargs, value *args) {
+    (void)nargs; (void)args;
+    // braced initialization converts the arguments from left to right
+    std::tuple<Args...> targs{get_arg<Args>(nv, nargs, args, Idx)...};
+    return call(std::integral_constant<bool, TakesEnv>(), seq, nv, targs);
+  }
+
+public:
+  /**
+   * @brief Convert the arguments and call the underlying function.
+   *
+   * This may throw, exceptions are caught by @ref module_function::invoke().
+   */
+  value operator()(envw nv, ptrdiff_t nargs, value *args) noexcept(false)
+  { return invoke(make_index_sequence<sizeof...(Args)>(), nv, nargs, args); }
+};
+
+template <typename F, typename Sig = typename callable_signature<F>::type>
+struct typed_invoker_of;
+template <typename F, typename Ret, typename...Params>
+struct typed_invoker_of<F, Ret(Params...)>
+{ using type = typed_invoker<F, Ret, false, decay_t<Params>...>; };
+template <typename F, typename Ret, typename...Params>
+struct typed_invoker_of<F, Ret(envw, Params...)>
+{ using type = typed_invoker<F, Ret, true, decay_t<Params>...>; };
+}
+
+/**
+ * @brief Make a module function whose arity and argument conversions are
+ * deduced from the signature of `f`.
+ *
+ * `f` must have exactly one call signature, so it can be a function pointer or
+ * a non-generic lambda. Its first parameter may be an @ref envw, which receives
+ * the environment, and each of the following parameters receives one argument,
+ * @link cppemacs_conversions converted @endlink with envw::extract() to its
+ * decayed type. Parameters may be:
+ *
+ * - Any @ref from_emacs_convertible type, for a required argument.
+ *
+ * - A `std::optional<T>` (C++17), for an `&optional` argument. It is empty if
+ *   the argument is absent or `nil`, and otherwise holds the converted `T`.
+ *   These can only be followed by other optional parameters, or a rest
+ *   parameter.
+ *
+ * - A trailing @ref spreader_restargs, for the `&rest` arguments.
+ *
+ * The result is @link cppemacs_conversions converted @endlink back to Emacs,
+ * or `nil` is returned if `f` returns `void`.
+ *
+ * Unlike make_spreader_function(), there are no @ref cell "cells" or
+ * cell_extracted wrappers involved, and the arity does not have to be spelled
+ * out separately from the parameter list.
+ *
+ * @snippet utils_examples.cpp Typed Functions
+ */
+template <typename F>
+auto make_typed_function(const char *doc, F &&f)
+  -> module_function<typename detail::typed_invoker_of<detail::decay_t<F>>::type>
+{
+  using invoker = typename detail::typed_invoker_of<detail::decay_t<F>>::type;
+  using arity = typename invoker::arity;
+  return module_function<invoker>(
+    arity::required,
+    arity::is_variadic ? emacs_variadic_function : ptrdiff_t(arity::positional),
+    doc, std::forward<F>(f));
+}
+
+#if (defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L) || defined(CPPEMACS_DOXYGEN_RUNNING)
+/** @brief Defined if @ref keyword_args is available. */
+#define CPPEMACS_HAVE_KEYWORD_ARGS 1
+
+/**
+ * @brief The name of a keyword, as a template argument of @ref keyword_args.
+ *
+ * This is implicitly constructed from a string literal without the leading
+ * colon, so `"limit"` names `:limit`.
+ */
+template <size_t N>
+struct keyword_name {
+  /** @brief The null-terminated name of the keyword symbol, including the colon. */
+  char str[N + 1] = {};
+
+  /** @brief Construct from a string literal. */
+  constexpr keyword_name(const char (&name)[N]) noexcept {
+    str[0] = ':';
+    for (size_t ii = 0; ii < N; ++ii) str[ii + 1] = name[ii];
+  }
+
+  /** @brief Compare the names of two keywords. */
+  template <size_t M>
+  constexpr bool operator==(const keyword_name<M> &o) const noexcept {
+    if (N != M) return false;
+    for (size_t ii = 0; ii < N; ++ii) if (str[ii] != o.str[ii]) return false;
+    return true;
+  }
+};
+
+namespace detail {
+/** @brief Signal that `key` is not an expected keyword argument, or has no value. */
+[[noreturn]] inline void bad_keyword_argument(envw nv, value key, bool missing_value) {
+  // built once, only the key varies between signals
+  static const struct prebuilt {
+    value error_sym, list_sym, unknown_msg, missing_msg;
+    prebuilt(envw nv) :
+      error_sym(nv.make_global_ref(nv.intern("error"))),
+      list_sym(nv.make_global_ref(nv.intern("list"))),
+      unknown_msg(nv.make_global_ref(nv.make_string("Unknown keyword argument"))),
+      missing_msg(nv.make_global_ref(nv.make_string("Missing value for keyword argument")))
+    { nv.maybe_non_local_exit(); }
+  } pre(nv);
+  value data[] = {missing_value ? pre.missing_msg : pre.unknown_msg, key};
+  value list = nv.funcall(pre.list_sym, 2, data);
+  nv.maybe_non_local_exit();
+  throw signalled(pre.error_sym, list);
+}
+}
+
+/**
+ * @brief Keyword arguments, parsed from a property list of `&rest` arguments.
+ *
+ * As the last parameter of a @link make_spreader_function() spreader
+ * function @endlink or @link make_typed_function() typed function @endlink,
+ * this accepts arguments like <code>:limit 10 :case-fold t</code>:
+ *
+ * @snippet utils_examples.cpp Keyword Arguments
+ *
+ * The keyword symbols are interned once, the first time any `keyword_args`
+ * with the same `Names` is parsed, and kept as global references for the
+ * lifetime of the module. Parsing is a single pass over the arguments, which
+ * compares each key with `eq` against each keyword. If a key is repeated, the
+ * first value is used, like `plist-get`.
+ *
+ * @throws signalled An `error` signal with data <code>("Unknown keyword
+ * argument" KEY)</code> if a key is not one of `Names`, or <code>("Missing
+ * value for keyword argument" KEY)</code> if the last key has no value.
+ */
+template <keyword_name...Names>
+struct keyword_args {
+  /** @brief The number of keywords. */
+  static constexpr size_t size = sizeof...(Names);
+
+private:
+  emacs_env *nv;
+  value vals[size + 1] = {};
+
+  template <keyword_name K>
+  static constexpr size_t index_of() noexcept {
+    size_t idx = 0, found = size;
+    ((K == Names ? (found = found == size ? idx : found, ++idx) : ++idx), ...);
+    return found;
+  }
+
+  template <keyword_name K>
+  static constexpr size_t checked_index() noexcept {
+    constexpr size_t idx = index_of<K>();
+    static_assert(idx < size, "Not one of the keywords of this keyword_args");
+    return idx;
+  }
+
+  static const value *keywords(envw nv) {
+    static const struct interned {
+      value syms[size + 1];
+      interned(envw nv) : syms{nv.make_global_ref(nv.intern(Names.str))...} {
+        nv.maybe_non_local_exit();
+      }
+    } kws(nv);
+    return kws.syms;
+  }
+
+public:
+  /** @brief Parse keyword arguments from `rest`. */
+  keyword_args(envw env, spreader_restargs rest) : nv(env) {
+    if (rest.size() == 0) return;
+    const value *kws = keywords(env);
+    for (size_t ii = 0; ii < rest.size(); ii += 2) {
+      value key = rest[ii];
+      size_t kw = 0;
+      while (kw < size && !env.eq(key, kws[kw])) ++kw;
+      if (kw == size) detail::bad_keyword_argument(env, key, false);
+      if (ii + 1 == rest.size()) detail::bad_keyword_argument(env, key, true);
+      if (!vals[kw]) vals[kw] = rest[ii + 1];
+    }
+  }
+
+  /** @brief Parse keyword arguments from `rest`, in the environment it was
+   * created with. */
+  explicit keyword_args(spreader_restargs rest) : keyword_args(rest.env(), rest) {}
+
+  /** @brief Whether the keyword `K` was given. */
+  template <keyword_name K>
+  bool has() const noexcept { return vals[checked_index<K>()] != nullptr; }
+
+  /** @brief Get the value given for `K`, or `nil` if it was not given. */
+  template <keyword_name K>
+  cell get() const {
+    value val = vals[checked_index<K>()];
+    envw env = nv;
+    return cell(env, val ? val : env.intern("nil"));
+  }
+
+  /**
+   * @brief Get the value given for `K` converted to `T`, or `dflt` if it was
+   * not given.
+   *
+   * Note that an explicit `nil` is converted as usual, rather than defaulted.
+   */
+  template <keyword_name K, FROM_EMACS_TYPE T>
+  T get(T dflt) const {
+    value val = vals[checked_index<K>()];
+    return val ? envw(nv).extract<T>(val) : dflt;
+  }
+};
+
+namespace detail {
+template <keyword_name...Names> struct typed_parameter<keyword_args<Names...>> {
+  static constexpr bool is_optional = false;
+  static constexpr bool is_rest = true;
+};
+}
+#endif
+
+/**
+ * @brief A @ref module_function, paired with the name it should be defined as.
+ *
+ * @see defun() and make_function_manifest()
+ */
+template <typename F>
+struct named_function {
+  /** @brief The null-terminated ASCII name of the symbol to define. */
+  const char *name;
+  /** @brief The function to define it as. */
+  module_function<F> func;
+};
+
+/** @brief Pair a @ref module_function with a name, for make_function_manifest(). */
+template <typename F>
+named_function<F> defun(const char *name, module_function<F> &&func) {
+  return named_function<F>{name, std::move(func)};
+}
+
+/**
+ * @brief A compile-time list of @ref named_function "named functions", which
+ * can be defined in one pass with define_functions().
+ *
+ * @see make_function_manifest() which infers `Fs`.
+ */
+template <typename...Fs>
+struct function_manifest {
+  /** @brief The functions to define. */
+  std::tuple<named_function<Fs>...> entries;
+
+private:
+  template <typename F>
+  static void define_one(envw nv, value definer, value name, module_function<F> &&func) {
+    value args[] = {name, nv->*std::move(func)};
+    nv.funcall(definer, 2, args);
+    nv.maybe_non_local_exit();
+  }
+
+  template <size_t...Idx>
+  void define_all(detail::index_sequence<Idx...>, envw nv, const char *definer) {
+    nv.maybe_non_local_exit();
+    // intern everything up front, the leading nullptr avoids a zero-size array
+    value names[] = {nullptr, nv.intern(std::get<Idx>(entries).name)...};
+    value definer_sym = nv.intern(definer);
+    nv.maybe_non_local_exit();
+    (void)names; (void)definer_sym;
+    (void)std::initializer_list<int>{
+      (define_one(nv, definer_sym, names[Idx + 1], std::move(std::get<Idx>(entries).func)), 0)...
+    };
+  }
+
+public:
+  /**
+   * @brief Define every function. This consumes the manifest.
+   *
+   * @see define_functions()
+   */
+  void define(envw nv, const char *definer = "defalias") && noexcept(false) {
+    define_all(detail::make_index_sequence<sizeof...(Fs)>(), nv, definer);
+  }
+};
+
+/**
+ * @brief Make a @ref function_manifest from @ref named_function "named functions".
+ *
+ * @snippet utils_examples.cpp Function Manifests
+ */
+template <typename...Fs>
+function_manifest<Fs...> make_function_manifest(named_function<Fs> &&...fns) {
+  return function_manifest<Fs...>{std::tuple<named_function<Fs>...>(std::move(fns)...)};
+}
+
+/**
+ * @brief Define every function in a @ref function_manifest.
+ *
+ * All the names are interned before any function is created, and
+ * `definer` is only interned once.
+ *
+ * @param definer The function that is called as `(definer NAME FUNCTION)`
+ * for each entry. This is `defalias` by default, but `fset` skips the
+ * bookkeeping that `defalias` does (`defalias-fset-function` and
+ * `load-history`), which is cheaper for modules with many functions.
+ *
+ * @throws non_local_exit (or as configured by @ref
+ * CPPEMACS_DEFAULT_EXCEPTION_BOXER) as soon as any definition fails.
+ */
+template <typename...Fs>
+void define_functions(envw nv, function_manifest<Fs...> &&manifest, const char *definer = "defalias") {
+  std::move(manifest).define(nv, definer);
+}
+
+namespace detail {
+/**
+ * @brief The state of a lazily materialized function.
+ *
+ * @see lazy_defun()
+ */
+template <typename Factory>
+class lazy_record {
+  // a copy, so the name passed to lazy_defun() need not outlive it
+  std::string name;
+  // a global reference to the real function, once materialized
+  value materialized = nullptr;
+  // only live until materialized
+  union { Factory factory; };
+
+public:
+  template <typename F>
+  lazy_record(const char *name, F &&factory) : name(name) {
+    new (&this->factory) Factory(std::forward<F>(factory));
+  }
+  lazy_record(const lazy_record &) = delete;
+  lazy_record &operator=(const lazy_record &) = delete;
+  ~lazy_record() { if (!materialized) factory.~Factory(); }
+
+  /** @brief The name of the symbol to define, which lives as long as the record. */
+  const char *symbol_name() const noexcept { return name.c_str(); }
+
+  /** @brief Materialize the real function if needed, and call it. */
+  value operator()(envw nv, ptrdiff_t nargs, value *args) {
+    if (!materialized) {
+      value fn = nv->*factory();
+      nv.maybe_non_local_exit();
+      // intentionally never freed, the stub might outlive its symbol binding
+      value ref = nv.make_global_ref(fn);
+      nv.maybe_non_local_exit();
+      // the factory has done its job, don't hold on to what it captured
+      factory.~Factory();
+      materialized = ref;
+      nv.funcall(nv.intern("fset"), {nv.intern(name.c_str()), fn});
+      nv.maybe_non_local_exit();
+    }
+    return nv.funcall(materialized, nargs, args);
+  }
+};
+
+/**
+ * @brief The stub of a lazily materialized function, which owns its @ref
+ * lazy_record until it is converted to Emacs.
+ *
+ * @see lazy_defun()
+ */
+template <typename Factory>
+struct lazy_stub {
+  /** @brief The shared state. */
+  std::unique_ptr<lazy_record<Factory>> record;
+
+  /** @brief Forward to the record. */
+  value operator()(envw nv, ptrdiff_t nargs, value *args) { return (*record)(nv, nargs, args); }
+};
+}
+
+#ifndef CPPEMACS_DOXYGEN_RUNNING
+/**
+ * Function representation for lazy_defun() stubs.
+ *
+ * The record pointer is passed directly as the function data, so no
+ * finalizer is registered. The record is leaked instead, which is one small
+ * allocation per stub, like the global reference it keeps to the real
+ * function.
+ */
+template <typename Factory>
+struct module_function_repr<detail::lazy_stub<Factory>> {
+  static detail::lazy_record<Factory> &extract(void *ptr) noexcept
+  { return *reinterpret_cast<detail::lazy_record<Factory> *>(ptr); }
+  static value make(
+    envw nv, ptrdiff_t min_arity, ptrdiff_t max_arity,
+    value (*fun)(emacs_env*, ptrdiff_t, value*, void*) noexcept,
+    const char *doc, detail::lazy_stub<Factory> &&f) noexcept {
+    value retfn = nv.make_function(min_arity, max_arity, fun, doc, f.record.get());
+    if (nv.non_local_exit_check()) return nullptr;
+    f.record.release(); // now owned by the function, forever
+    return retfn;
+  }
+};
+#endif
+
+/**
+ * @brief Define `name` as a cheap stub, which only creates the real function
+ * the first time it is called.
+ *
+ * On the first call, the stub invokes `factory()`, @ref cppemacs_conversions
+ * "converts" the result to an Emacs function, `fset`s `name` to it, and
+ * forwards the call. Later calls go directly to the real function, unless a
+ * reference to the stub itself was kept, in which case it forwards to the same
+ * (cached) real function.
+ *
+ * This defers the construction of the real function's state, and its
+ * finalizer registration, until it is actually needed. The stub itself needs
+ * no finalizer, only a small record which is never freed.
+ *
+ * @param name The name of the function, as for defun(). This is copied, so
+ * it need not outlive the call.
+ * @param min_arity The minimum arity of the real function.
+ * @param max_arity The maximum arity of the real function.
+ * @param doc The documentation string of the stub, which is shown until the
+ * function is first called.
+ * @param factory A nullary callable, returning a to-Emacs-convertible function,
+ * typically a @ref module_function.
+ *
+ * @returns A @ref named_function for make_function_manifest().
+ *
+ * @snippet utils_examples.cpp Function Manifests
+ */
+template <typename Factory>
+auto lazy_defun(
+  const char *name, ptrdiff_t min_arity, ptrdiff_t max_arity,
+  const char *doc, Factory &&factory
+) -> named_function<detail::lazy_stub<detail::decay_t<Factory>>> {
+  using record = detail::lazy_record<detail::decay_t<Factory>>;
+  using stub = detail::lazy_stub<detail::decay_t<Factory>>;
+  std::unique_ptr<record> rec(new record(name, std::forward<Factory>(factory)));
+  // name the manifest entry with the record's copy, not the caller's string
+  const char *copied_name = rec->symbol_name();
+  return defun(copied_name, module_function<stub>(
+                 min_arity, max_arity, doc, stub{std::move(rec)}));
+}
+
+CPPEMACS_SUPPRESS_WCOMPAT_MANGLING_BEGIN
+/**
+ * @brief A plain module function specification, for static arrays of
+ * functions which don't capture any state.
+ *
+ * Since these need no finalizers, these are the cheapest functions to define.
+ *
+ * @code
+ * static const function_spec specs[] = {
+ *   {"my-module-foo", 1, 1, &my_module_foo, "Do foo with X.\n\n(fn X)", nullptr},
+ *   {"my-module-bar", 0, 2, &my_module_bar, "Do bar.\n\n(fn &optional X Y)", nullptr},
+ * };
+ * define_functions(env, specs);
+ * @endcode
+ */
+struct function_spec {
+  /** @brief The null-terminated ASCII name of the symbol to define. */
+  const char *name;
+  /** @brief See envw::make_function(). */
+  ptrdiff_t min_arity;
+  /** @brief See envw::make_function(). */
+  ptrdiff_t max_arity;
+  /** @brief See envw::make_function(). */
+  value (*func)(emacs_env *, ptrdiff_t, value *, void *) noexcept;
+  /** @brief See envw::make_function(). */
+  const char *doc;
+  /** @brief See envw::make_function(). */
+  void *data;
+};
+CPPEMACS_SUPPRESS_WCOMPAT_MANGLING_END
+
+/**
+ * @brief Define every function in an array of @ref function_spec "function specs".
+ *
+ * @see define_functions(envw, function_manifest<Fs...>&&, const char *) for the
+ * meaning of `definer`.
+ */
+inline void define_functions(envw nv, const function_spec *specs, size_t count, const char *definer = "defalias") {
+  nv.maybe_non_local_exit();
+  value definer_sym = nv.intern(definer);
+  for (size_t ii = 0; ii < count; ++ii) {
+    const function_spec &spec = specs[ii];
+    value args[] = {
+      nv.intern(spec.name),
+      nv.make_function(spec.min_arity, spec.max_arity, spec.func, spec.doc, spec.data)
+    };
+    nv.funcall(definer_sym, 2, args);
+    nv.maybe_non_local_exit();
+  }
+}
+
+/** @brief Define every function in an array of @ref function_spec "function specs". */
+template <size_t N>
+void define_functions(envw nv, const function_spec (&specs)[N], const char *definer = "defalias") {
+  define_functions(nv, specs, N, definer);
+}
+
+namespace detail {
+inline value native_memory_lisp_stats(emacs_env *raw, ptrdiff_t, value *, void *) noexcept {
+  env_call_scope scope;
+  envw nv = raw;
+  return nv.run_catching([&]() -> value {
+    cell list = nv->*"list";
+    cell types = nv->*nullptr;
+    for (auto acct = native_memory::accounts(); acct; acct = acct->next) {
+      types = (nv->*"cons")(
+        list(std::string(acct->name),
+             intmax_t(acct->live_bytes.load(std::memory_order_relaxed)),
+             intmax_t(acct->live_objects.load(std::memory_order_relaxed))),
+        types);
+    }
+    native_memory_stats stats = native_memory::statistics();
+    return list(":live-bytes", intmax_t(stats.live_bytes),
+                ":live-objects", intmax_t(stats.live_objects),
+                ":allocated-since-gc", intmax_t(stats.allocated_since_gc),
+                ":types", types);
+  });
+}
+
+inline value native_memory_after_gc(emacs_env *, ptrdiff_t, value *, void *) noexcept {
+  native_memory::reset_since_gc();
+  return nullptr;
+}
+}
+
+/**
+ * @brief Define a Lisp function reporting @ref native_memory statistics, and
+ * reset the count of bytes allocated since the last garbage collection after
+ * each one, using `post-gc-hook`.
+ *
+ * The function, `name`, returns a plist like
+ * @code{.el}
+ * (:live-bytes 1024 :live-objects 2 :allocated-since-gc 512
+ *  :types (("TYPE" 1024 2) ...))
+ * @endcode
+ * The hook function is named `name--after-gc`.
+ *
+ * @param nv The environment.
+ * @param name The name of the statistics function.
+ * @param gc_threshold See @ref native_memory::set_gc_threshold(), 0 to not
+ * trigger garbage collections.
+ */
+inline void install_native_memory_accounting(
+  envw nv, const char *name = "cppemacs-native-memory", size_t gc_threshold = 0
+) {
+  native_memory::set_gc_threshold(gc_threshold);
+  std::string hook_name = std::string(name) + "--after-gc";
+  const function_spec specs[] = {
+    {name, 0, 0, &detail::native_memory_lisp_stats,
+     "Return statistics of the native memory held by module objects.", nullptr},
+    {hook_name.c_str(), 0, 0, &detail::native_memory_after_gc,
+     "Reset the count of native memory allocated since the last GC.", nullptr},
+  };
+  define_functions(nv, specs);
+  nv.funcall(nv.intern("add-hook"), {nv.intern("post-gc-hook"), nv.intern(hook_name.c_str())});
+  nv.maybe_non_local_exit();
+}
+
 /** @brief Output a cell to an output stream, using `(format "%s" v)`. */
 inline std::ostream &operator<<(std::ostream &os, const cell &v) {
   return os << (v->*"format")(v->make_string("%s", 2), v).extract<std::string>();
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2024 Eutro <https://eutro.dev>
+ *
+ * This file is part of cppemacs.
+ *
+ * cppemacs is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cppemacs is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cppemacs. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: 2024 Eutro <https://eutro.dev>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// Benchmarks are hidden, run them with the "[benchmark]" tag:
+//   emacs -Q --batch --script tests/test.el -- path/to/libcppemacs_test.so "[benchmark]"
+
+#include "common.hpp"
+
+TEST_SCOPED(TEST_CASE("module function call overhead", "[.][benchmark]")) {
+  cell arity0 = envp->*make_spreader_function(
+    spreader_thunk(), "Arity 0.",
+    [](envw) { return nullptr; });
+  cell arity1 = envp->*make_spreader_function(
+    spreader_arity<1>(), "Arity 1.",
+    [](envw, value x) { return x; });
+  cell arity4 = envp->*make_spreader_function(
+    spreader_arity<4>(), "Arity 4.",
+    [](envw, value, value, value, value x) { return x; });
+  cell arity1_4 = envp->*make_spreader_function(
+    spreader_arity<1, 4>(), "Arity 1 to 4.",
+    [](envw, value x, value, value, value) { return x; });
+  cell variadic = envp->*make_spreader_function(
+    spreader_variadic<0>(), "Variadic.",
+    [](envw, spreader_restargs rest) { return static_cast<int>(rest.size()); });
+  cell identity = envp->*"identity";
+
+  value args[] = {envp->*1, envp->*2, envp->*3, envp->*4};
+
+  BENCHMARK("baseline: identity") { return identity.call(1, args); };
+  BENCHMARK("arity 0") { return arity0.call(0, args); };
+  BENCHMARK("arity 1") { return arity1.call(1, args); };
+  BENCHMARK("arity 4") { return arity4.call(4, args); };
+  BENCHMARK("arity 1-4, called with 1") { return arity1_4.call(1, args); };
+  BENCHMARK("arity 1-4, called with 4") { return arity1_4.call(4, args); };
+  BENCHMARK("variadic, called with 0") { return variadic.call(0, args); };
+  BENCHMARK("variadic, called with 4") { return variadic.call(4, args); };
+}
+
+TEST_SCOPED(TEST_CASE("module function error overhead", "[.][benchmark]")) {
+  cell throwing = envp->*make_spreader_function(
+    spreader_arity<1>(), "Signal by throwing.",
+    [](envw nv, value) -> value { throw error_signal(nv, "Rejected"); });
+  cell returning = envp->*make_spreader_function(
+    spreader_arity<1>(), "Signal by returning.",
+    [](envw nv, value) -> signal_or<value> { return error_signal(nv, "Rejected"); });
+
+  value args[] = {envp->*1};
+
+  auto call_and_clear = [&](cell &fun) {
+    fun.call(1, args);
+    envp.non_local_exit_clear();
+  };
+  BENCHMARK("signal by throwing") { call_and_clear(throwing); };
+  BENCHMARK("signal by returning signal_or") { call_and_clear(returning); };
+}
+
+TEST_SCOPED(TEST_CASE("user_ptr allocation", "[.][benchmark]")) {
+  struct small_node { intmax_t value; small_node *next; };
+  const int count = 1000;
+
+  BENCHMARK("make_user_ptr") {
+    envp.run_scoped([&](envw env) {
+      for (int i = 0; i < count; ++i) env->*make_user_ptr<small_node>(small_node{i, nullptr});
+    });
+    return (envp->*"garbage-collect")();
+  };
+  BENCHMARK("make_pooled_user_ptr") {
+    envp.run_scoped([&](envw env) {
+      for (int i = 0; i < count; ++i) env->*make_pooled_user_ptr<small_node>(small_node{i, nullptr});
+    });
+    return (envp->*"garbage-collect")();
+  };
+}
+
+#if (EMACS_MAJOR_VERSION >= 27) && CPPEMACS_ENABLE_GMPXX
+TEST_SCOPED(TEST_CASE("bignum conversion", "[.][benchmark]")) {
+  for (int limbs : {1, 2, 4, 8, 16, 64}) {
+    mpz_class n = (mpz_class(1) << (limbs * 64 - 1)) + 12345;
+    cell val = envp->*n;
+    std::string suffix = std::to_string(limbs) + " limbs";
+
+    BENCHMARK("to_emacs, " + suffix) { return envp->*n; };
+    BENCHMARK("from_emacs, " + suffix) { return val.extract<mpz_class>(); };
+  }
+}
+#endif
@@ -87,6 +87,9 @@ REGISTER_NAME(eread_literal);
 #ifdef CPPEMACS_HAVE_STRING_VIEW
 REGISTER_NAME(std::string_view);
 #endif
+#if (EMACS_MAJOR_VERSION >= 27)
+REGISTER_NAME(big_integer);
+#endif
 #if CPPEMACS_ENABLE_GMPXX
 REGISTER_NAME(mpz_class);
 #endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2024 Eutro <https://eutro.dev>
+ *
+ * This file is part of cppemacs.
+ *
+ * cppemacs is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cppemacs is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cppemacs. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: 2024 Eutro <https://eutro.dev>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// built with CPPEMACS_ENABLE_CHECKED_ENV, checks that misusing an envw aborts
+
+#include <cppemacs/all.hpp>
+
+#ifndef _WIN32
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace cppemacs;
+
+static_assert(CPPEMACS_ENABLE_CHECKED_ENV, "Must be built with CPPEMACS_ENABLE_CHECKED_ENV");
+
+// never called through, since the checks come first
+static emacs_env dummy_env;
+
+// run f in a child process, and return whether it aborted
+template <typename F>
+static bool aborts(F f) {
+  std::fflush(nullptr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    std::perror("fork");
+    std::exit(2);
+  }
+  if (pid == 0) {
+    f();
+    std::_Exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+static void use(envw nv) {
+  emacs_env *volatile raw = nv;
+  (void)raw;
+}
+
+static int failures = 0;
+static void expect(bool ok, const char *what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++failures;
+  }
+}
+
+int main() {
+  expect(!aborts([]() {
+    env_call_scope scope;
+    use(envw(&dummy_env));
+  }), "an envw can be used during its call");
+
+  expect(aborts([]() {
+    envw stale = nullptr;
+    {
+      env_call_scope scope;
+      stale = envw(&dummy_env);
+    }
+    use(stale);
+  }), "an envw cannot be used after its call returns");
+
+  expect(aborts([]() {
+    env_call_scope scope;
+    envw nv(&dummy_env);
+    // from_emacs for std::string takes a raw emacs_env *
+    std::thread([nv]() { (void)nv.extract<std::string>(nullptr); }).join();
+  }), "an envw cannot be used for conversions on another thread");
+
+  return failures ? 1 : 0;
+}
+#else
+int main() {
+}
+#endif
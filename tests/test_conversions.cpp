@@ -31,6 +31,11 @@ struct is_the_same {
     THEN("the result is the same") {
       CHECK(lhs == val.extract<Res>());
     }
+    THEN("the result is the same with try_extract") {
+      Res res{};
+      CHECK(envp.try_extract(val, res));
+      CHECK(lhs == res);
+    }
   }
 };
 
@@ -40,6 +45,16 @@ struct throws_an_exception {
     THEN("an exception is thrown") {
       CHECK_THROWS(val.extract<Res>());
     }
+    THEN("try_extract fails without a pending non-local exit") {
+      Res res{};
+      CHECK_FALSE(envp.try_extract(val, res));
+      CHECK_FALSE(envp.non_local_exit_check());
+    }
+    THEN("try_extract can keep the non-local exit") {
+      Res res{};
+      CHECK_FALSE(envp.try_extract(val, res, conversion_exit::keep));
+      CHECK(envp.non_local_exit_check());
+    }
   }
 };
 
@@ -112,12 +127,23 @@ TEST_SCOPED(TEST_CASE("General conversions")) {
     checkRoundTrip<eread_literal, uintmax_t, throws_an_exception>(
       eread_literal(std::to_string(UINTMAX_MAX) += "0"));
 
+    checkRoundTrip<big_integer>(0);
+    checkRoundTrip<big_integer>(-99);
+    checkRoundTrip<big_integer>(INTMAX_MIN);
+    checkRoundTrip<big_integer>(UINTMAX_MAX);
+    checkRoundTrip<big_integer>(big_integer(1, std::vector<emacs_limb_t>(20, 0xff)));
+    checkRoundTrip<big_integer>(big_integer(-1, std::vector<emacs_limb_t>(20, 0xff)));
+    checkRoundTrip<estring_literal, big_integer, throws_an_exception>("not an integer"_Estr);
+
 #  if CPPEMACS_ENABLE_GMPXX
     checkRoundTrip<mpz_class>(mpz_class(0));
     checkRoundTrip<mpz_class>(mpz_class(-99));
     checkRoundTrip<mpz_class>(mpz_class(99));
     checkRoundTrip<mpz_class>(mpz_class(LONG_MAX) * LONG_MAX * LONG_MAX - 999);
     checkRoundTrip<mpz_class>(mpz_class(LONG_MIN) * LONG_MAX * LONG_MAX + 999);
+    // more limbs than fit on the stack
+    checkRoundTrip<mpz_class>((mpz_class(1) << 1000) - 999);
+    checkRoundTrip<mpz_class>(999 - (mpz_class(1) << 1000));
 
     checkRoundTrip<estring_literal, mpz_class, throws_an_exception>("not an integer"_Estr);
 #  endif
@@ -128,6 +154,110 @@ TEST_SCOPED(TEST_CASE("General conversions")) {
   checkRoundTrip<std::string, int, throws_an_exception>("abcd");
 }
 
+#if (EMACS_MAJOR_VERSION >= 27)
+SCOPED_SCENARIO("big integer arithmetic") {
+  if (!envp.is_compatible<27>()) SKIP("Emacs 27+ required");
+
+  GIVEN("some big integers") {
+    cell big = envp->*eread_literal("(expt 7 200)");
+    cell small = envp->*eread_literal("(- (expt 2 64) 3)");
+    cell neg = envp->*"-";
+    big_integer b = big.extract<big_integer>(), s = small.extract<big_integer>();
+
+    THEN("they compare like Lisp integers") {
+      CHECK(s < b);
+      CHECK(-b < -s);
+      CHECK(-b < s);
+      CHECK(b == b + 0);
+      CHECK(b != -b);
+      CHECK(big_integer(2, {1}) == big_integer(1));
+      CHECK(big_integer(-7, {1}) * big_integer(-7, {1}) == big_integer(1));
+    }
+
+    THEN("arithmetic agrees with Lisp") {
+      for (const cell &x : {big, small, neg(big), neg(small)}) {
+        for (const cell &y : {big, small, neg(big), neg(small)}) {
+          big_integer xb = x.extract<big_integer>(), yb = y.extract<big_integer>();
+          CHECK_THAT(envp->*(xb + yb), LispEquals((envp->*"+")(x, y)));
+          CHECK_THAT(envp->*(xb - yb), LispEquals((envp->*"-")(x, y)));
+          CHECK_THAT(envp->*(xb * yb), LispEquals((envp->*"*")(x, y)));
+        }
+      }
+      CHECK((b - b).sign() == 0);
+      CHECK((b - b).magnitude().empty());
+    }
+
+    THEN("they format like Lisp integers") {
+      CHECK(b.to_string() == (envp->*"number-to-string")(big).extract<std::string>());
+      CHECK((-s).to_string() == (envp->*"number-to-string")(neg(small)).extract<std::string>());
+      CHECK(big_integer().to_string() == "0");
+    }
+  }
+}
+#endif
+
+#if (EMACS_MAJOR_VERSION >= 27) && defined(CPPEMACS_HAVE_INT128)
+SCOPED_SCENARIO("128-bit integer conversion") {
+  if (!envp.is_compatible<27>()) SKIP("Emacs 27+ required");
+
+  // no operator<< for these, so no checkRoundTrip
+  GIVEN("signed 128-bit integers") {
+    const std::pair<int128, const char *> cases[] = {
+      {0, "0"},
+      {-5, "-5"},
+      {int128(INTMAX_MIN) - 1, "(1- (- (expt 2 63)))"},
+      {std::numeric_limits<int128>::max(), "(1- (expt 2 127))"},
+      {std::numeric_limits<int128>::min(), "(- (expt 2 127))"},
+    };
+    THEN("they round-trip through Lisp integers") {
+      for (const auto &c : cases) {
+        cell expected = envp->*eread_literal(c.second);
+        CHECK_THAT(envp->*c.first, LispEquals(expected));
+        CHECK(expected.extract<int128>() == c.first);
+        int128 out = 0;
+        CHECK(envp.try_extract(expected, out));
+        CHECK(out == c.first);
+      }
+    }
+  }
+
+  GIVEN("unsigned 128-bit integers") {
+    const std::pair<uint128, const char *> cases[] = {
+      {0, "0"},
+      {uint128(1) << 64, "(expt 2 64)"},
+      {~uint128(0), "(1- (expt 2 128))"},
+    };
+    THEN("they round-trip through Lisp integers") {
+      for (const auto &c : cases) {
+        cell expected = envp->*eread_literal(c.second);
+        CHECK_THAT(envp->*c.first, LispEquals(expected));
+        CHECK(expected.extract<uint128>() == c.first);
+      }
+    }
+  }
+
+  GIVEN("integers out of range") {
+    cell too_big = envp->*eread_literal("(expt 2 128)");
+    cell negative = envp->*-1;
+    cell signed_too_big = envp->*eread_literal("(expt 2 127)");
+    THEN("extraction throws") {
+      CHECK_THROWS(too_big.extract<uint128>());
+      CHECK_THROWS(negative.extract<uint128>());
+      CHECK_THROWS(signed_too_big.extract<int128>());
+      CHECK_THROWS(too_big.extract<int128>());
+    }
+    THEN("try_extract fails without a pending non-local exit") {
+      int128 s = 0;
+      uint128 u = 0;
+      CHECK_FALSE(envp.try_extract(negative, u));
+      CHECK_FALSE(envp.try_extract(too_big, u));
+      CHECK_FALSE(envp.try_extract(signed_too_big, s));
+      CHECK_FALSE(envp.non_local_exit_check());
+    }
+  }
+}
+#endif
+
 SCOPED_CASE("module_function") {
   std::shared_ptr<int> sptr{new int{0}};
   REQUIRE(sptr.use_count() == 1);
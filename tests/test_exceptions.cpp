@@ -70,6 +70,20 @@ SCOPED_CASE("exceptions") {
                  return false;
                }));
 
+    defalias("cppemacs-fun7", envp->*make_spreader_function(
+               spreader_arity<1>(),
+               "Return the argument if it is non-nil, otherwise return an `error' signal.",
+               [](envw nv, value x) -> signal_or<value> {
+                 if (!nv.is_not_nil(x)) return error_signal(nv, "Returned error");
+                 return x;
+               }));
+
+    defalias("cppemacs-fun8", envp->*make_spreader_function(
+               spreader_arity<2>(),
+               "Return a `throw' to TAG with VALUE.",
+               [](envw, value tag, value val) -> signal_or<value>
+               { return thrown(tag, val); }));
+
     auto [expr, sig_type] = GENERATE(
       std::make_pair(
         R"((signal 'error '("normal error")))"_Eread,
@@ -110,6 +124,19 @@ SCOPED_CASE("exceptions") {
       std::make_pair(
         R"((cppemacs-fun6 1 2 3))"_Eread,
         funcall_exit::return_
+      ),
+
+      std::make_pair(
+        R"((cppemacs-fun7 nil))"_Eread,
+        funcall_exit::signal_
+      ),
+      std::make_pair(
+        R"((cppemacs-fun7 t))"_Eread,
+        funcall_exit::return_
+      ),
+      std::make_pair(
+        R"((cppemacs-fun8 'hello 'returned-value))"_Eread,
+        funcall_exit::throw_
       )
     );
     WHEN("evaluating " << expr) {
@@ -150,6 +177,20 @@ SCOPED_SCENARIO("transparently throwing exceptions") {
           });
         });
 
+      WHEN("exception boxing is registered more than once") {
+        register_exception_boxing(envp);
+        register_exception_boxing(envp);
+
+        THEN("it is signalled as `cppemacs--exception'") {
+          throw_cool_exn();
+          value symbol, data;
+          REQUIRE(envp.non_local_exit_get(symbol, data) == funcall_exit::signal_);
+          envp.non_local_exit_clear();
+          REQUIRE(envp.eq(symbol, envp.intern("cppemacs--exception")));
+          REQUIRE_THAT((envp->*"get")(symbol, "error-message"), LispEquals("Opaque C++ exception"_Estr));
+        }
+      }
+
       WHEN("it is called") {
         THEN("the correct exception is thrown") {
           REQUIRE_THROWS_AS(
@@ -177,3 +218,123 @@ SCOPED_SCENARIO("transparently throwing exceptions") {
     }
   }
 }
+
+SCOPED_SCENARIO("copying signal_or") {
+  GIVEN("a signal_or<bool> holding a signal") {
+    signal_or<bool> failed = error_signal(envp, "Failed");
+    REQUIRE_FALSE(failed.ok());
+
+    WHEN("it is copied from a non-const lvalue") {
+      signal_or<bool> copy = failed;
+      signal_or<bool> assigned = true;
+      assigned = failed;
+
+      THEN("the copies hold the signal too") {
+        REQUIRE_FALSE(copy.ok());
+        REQUIRE_FALSE(assigned.ok());
+      }
+    }
+  }
+
+  GIVEN("a signal_or<bool> holding false") {
+    signal_or<bool> no = false;
+
+    THEN("copies hold false") {
+      signal_or<bool> copy = no;
+      REQUIRE(copy.ok());
+      REQUIRE_FALSE(copy.get());
+    }
+  }
+}
+
+struct registered_parse_error : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+SCOPED_SCENARIO("registered exception types") {
+  GIVEN("an exception type registered with its own error") {
+    exception_registry::instance().define<registered_parse_error>(
+      envp, "cppemacs-test-parse-error", "Test parse error");
+
+    cell throw_parse_error = envp->*make_spreader_function(
+      spreader_arity<1>(), "Throw `registered_parse_error' with MESSAGE.",
+      [](envw, cell_extracted<std::string> msg) -> value {
+        throw registered_parse_error(msg.get());
+      });
+    (envp->*"defalias")("cppemacs--test-throw-parse-error", throw_parse_error);
+
+    WHEN("it is thrown") {
+      THEN("it is signalled as its error, which inherits from `error'") {
+        REQUIRE_THAT(
+          (envp->*"eval")(R"((condition-case err
+                                 (cppemacs--test-throw-parse-error "bad")
+                               (error err)))"_Eread),
+          LispEquals(R"((cppemacs-test-parse-error "bad"))"_Eread));
+      }
+
+      THEN("it is converted back with exception boxing") {
+        using Catch::Matchers::Message;
+        REQUIRE_THROWS_MATCHES(
+          (throw_parse_error("bad"_Estr),
+           envp.rethrow_non_local_exit<try_box_exceptions>()),
+          registered_parse_error,
+          Message("bad"));
+      }
+
+      THEN("it is signalled without exception boxing") {
+        REQUIRE_THROWS_AS(
+          (throw_parse_error("bad"_Estr),
+           envp.rethrow_non_local_exit<dont_box_exceptions>()),
+          signalled);
+      }
+    }
+
+    WHEN("another error's entry property is set by someone else") {
+      static int not_an_entry;
+      (envp->*"define-error")("cppemacs-test-foreign-error", "Foreign error"_Estr);
+      (envp->*"put")("cppemacs-test-foreign-error", "cppemacs--exception-entry",
+                     envp.make_user_ptr(nullptr, &not_an_entry));
+
+      THEN("it is not mistaken for a registered exception") {
+        envp.non_local_exit_signal(envp->*"cppemacs-test-foreign-error", (envp->*"list")("x"_Estr));
+        REQUIRE_THROWS_AS(envp.rethrow_non_local_exit<try_box_exceptions>(), signalled);
+      }
+    }
+  }
+}
+
+#if (EMACS_MAJOR_VERSION >= 26)
+SCOPED_SCENARIO("checking for quits") {
+  GIVEN("a quit checker") {
+    quit_checker quit(envp, std::chrono::milliseconds(1));
+
+    WHEN("it is ticked without a quit") {
+      auto start = quit_checker::clock::now();
+      while (quit_checker::clock::now() - start < std::chrono::milliseconds(20)) quit.tick();
+
+      THEN("it checks less often than every iteration") {
+        REQUIRE(quit.current_stride() > 1);
+      }
+    }
+  }
+
+  GIVEN("a function which spins until quitting") {
+    (envp->*"defalias")("cppemacs--test-spin-until-quit", envp->*make_spreader_function(
+      spreader_thunk(), "Set `quit-flag', then spin until the quit is noticed.",
+      [](envw nv) {
+        nv.funcall(nv.intern("set"), {nv.intern("quit-flag"), nv.intern("t")});
+        quit_checker quit(nv, std::chrono::milliseconds(1));
+        for (long ii = 0; ii < 1000000000L; ++ii) quit.tick();
+        return nullptr;
+      }));
+
+    THEN("the quit is signalled") {
+      REQUIRE_THAT(
+        (envp->*"eval")(R"((condition-case nil
+                               (cppemacs--test-spin-until-quit)
+                             (quit 'quit)))"_Eread),
+        LispEquals(envp->*"quit"));
+    }
+  }
+}
+#endif
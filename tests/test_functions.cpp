@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2024 Eutro <https://eutro.dev>
+ *
+ * This file is part of cppemacs.
+ *
+ * cppemacs is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cppemacs is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cppemacs. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: 2024 Eutro <https://eutro.dev>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "common.hpp"
+#include <algorithm>
+#include <optional>
+
+static value manifest_raw_function(emacs_env *raw_env, ptrdiff_t nargs, value *args, void *) noexcept {
+  envw env = raw_env;
+  return env.funcall(env.intern("list"), nargs, args);
+}
+
+SCOPED_SCENARIO("defining functions in bulk") {
+  GIVEN("a function manifest") {
+    auto manifest = make_function_manifest(
+      defun("cppemacs-manifest-fun1", make_spreader_function(
+              spreader_arity<2>(), "Add X and Y.",
+              [](envw, cell_extracted<int> x, cell_extracted<int> y) -> int
+              { return x.get() + y.get(); })),
+      defun("cppemacs-manifest-fun2", make_spreader_function(
+              spreader_thunk(), "Return a string.",
+              [](envw) { return "manifest"_Estr; })));
+
+    WHEN("it is defined") {
+      define_functions(envp, std::move(manifest));
+
+      THEN("all the functions are callable") {
+        REQUIRE_THAT((envp->*"cppemacs-manifest-fun1")(1, 2), LispEquals(3));
+        REQUIRE_THAT((envp->*"cppemacs-manifest-fun2")(), LispEquals("manifest"_Estr));
+      }
+    }
+  }
+
+  GIVEN("an array of function specs") {
+    static const function_spec specs[] = {
+      {"cppemacs-manifest-fun3", 0, 2, &manifest_raw_function, "List up to two arguments.", nullptr},
+      {"cppemacs-manifest-fun4", 1, cppemacs::emacs_variadic_function, &manifest_raw_function, "List the arguments.", nullptr},
+    };
+
+    WHEN("they are defined with `fset'") {
+      define_functions(envp, specs, "fset");
+
+      THEN("all the functions are callable") {
+        REQUIRE_THAT((envp->*"cppemacs-manifest-fun3")(1, 2), LispEquals((envp->*"list")(1, 2)));
+        REQUIRE_THAT((envp->*"cppemacs-manifest-fun4")(1, 2, 3), LispEquals((envp->*"list")(1, 2, 3)));
+      }
+    }
+  }
+}
+
+SCOPED_SCENARIO("lazily defining functions") {
+  GIVEN("a lazily defined function") {
+    static int factory_calls;
+    factory_calls = 0;
+    std::shared_ptr<int> captured = std::make_shared<int>(0);
+    // the name is copied, so the manifest can outlive a temporary name
+    auto manifest = make_function_manifest(
+      lazy_defun(std::string("cppemacs-lazy-fun1").c_str(), 1, 1, "Lazily add 1 to X.", [captured]() {
+        ++factory_calls;
+        return make_spreader_function(
+          spreader_arity<1>(), "Add 1 to X.",
+          [](envw, cell_extracted<int> x) -> int { return x.get() + 1; });
+      }));
+    define_functions(envp, std::move(manifest));
+    cell stub = (envp->*"symbol-function")("cppemacs-lazy-fun1");
+
+    THEN("the real function is not created yet") {
+      REQUIRE(factory_calls == 0);
+      REQUIRE(captured.use_count() == 2);
+    }
+
+    WHEN("it is called") {
+      cell fun = envp->*"cppemacs-lazy-fun1";
+      REQUIRE_THAT(fun(1), LispEquals(2));
+      REQUIRE_THAT(fun(2), LispEquals(3));
+
+      THEN("the real function is created once, and replaces the stub") {
+        REQUIRE(factory_calls == 1);
+        REQUIRE_FALSE((envp->*"symbol-function")("cppemacs-lazy-fun1") == stub);
+      }
+
+      THEN("the factory is released") {
+        REQUIRE(captured.use_count() == 1);
+      }
+
+      AND_WHEN("the old stub is called") {
+        THEN("it forwards to the same function") {
+          REQUIRE_THAT(stub(5), LispEquals(6));
+          REQUIRE(factory_calls == 1);
+        }
+      }
+    }
+  }
+}
+
+static intmax_t typed_plain_add(intmax_t x, intmax_t y) { return x + y; }
+
+SCOPED_SCENARIO("typed module functions") {
+  GIVEN("typed functions with required arguments") {
+    cell add = envp->*make_typed_function(
+      "Add X and Y.", [](envw, int x, int y) { return x + y; });
+    cell plain_add = envp->*make_typed_function("Add X and Y.", &typed_plain_add);
+    cell concat = envp->*make_typed_function(
+      "Concatenate X and Y.", [](std::string x, const std::string &y) { return x + y; });
+
+    THEN("the arguments and results are converted") {
+      REQUIRE_THAT(add(1, 2), LispEquals(3));
+      REQUIRE_THAT(plain_add(3, 4), LispEquals(7));
+      REQUIRE_THAT(concat("foo"_Estr, "bar"_Estr), LispEquals("foobar"_Estr));
+    }
+
+    THEN("arguments of the wrong type signal an error") {
+      REQUIRE_THROWS((add(1, "two"_Estr), envp.maybe_non_local_exit()));
+    }
+  }
+
+  GIVEN("a typed function with optional and rest arguments") {
+    auto func = make_typed_function(
+      "Add X, Y or 10, and the number of REST.",
+      [](envw, int x, std::optional<int> y, spreader_restargs rest) {
+        return x + y.value_or(10) + int(rest.size());
+      });
+
+    THEN("the arity is deduced") {
+      REQUIRE(func.min_arity == 1);
+      REQUIRE(func.max_arity == cppemacs::emacs_variadic_function);
+    }
+
+    WHEN("it is called") {
+      cell fun = envp->*std::move(func);
+      THEN("absent and nil optional arguments are empty") {
+        REQUIRE_THAT(fun(1), LispEquals(11));
+        REQUIRE_THAT(fun(1, nullptr), LispEquals(11));
+        REQUIRE_THAT(fun(1, 2), LispEquals(3));
+        REQUIRE_THAT(fun(1, 2, 0, 0), LispEquals(5));
+      }
+    }
+  }
+
+  GIVEN("a typed function returning void") {
+    cell fun = envp->*make_typed_function("Return nil.", [](value) {});
+    THEN("it returns nil") {
+      REQUIRE_FALSE(fun(1));
+    }
+  }
+}
+
+#ifdef CPPEMACS_HAVE_KEYWORD_ARGS
+SCOPED_SCENARIO("keyword arguments") {
+  GIVEN("a function with keyword arguments") {
+    cell fun = envp->*make_typed_function(
+      "Return X, or LIMIT if it is less, negated if NEGATE.",
+      [](int x, keyword_args<"limit", "negate"> kws) {
+        int ret = std::min(x, kws.get<"limit">(x));
+        return kws.get<"negate">() ? -ret : ret;
+      });
+
+    THEN("keywords can be omitted, given in any order, or repeated") {
+      REQUIRE_THAT(fun(5), LispEquals(5));
+      REQUIRE_THAT(fun(5, ":limit", 3), LispEquals(3));
+      REQUIRE_THAT(fun(5, ":negate", "t", ":limit", 3), LispEquals(-3));
+      REQUIRE_THAT(fun(5, ":limit", 3, ":limit", 1), LispEquals(3));
+    }
+
+    THEN("unknown keywords and missing values signal an error") {
+      REQUIRE_THROWS((fun(5, ":other", 3), envp.maybe_non_local_exit()));
+      REQUIRE_THROWS((fun(5, ":limit"), envp.maybe_non_local_exit()));
+    }
+  }
+
+  GIVEN("a spreader function with keyword arguments") {
+    cell fun = envp->*make_spreader_function(
+      spreader_variadic<0>(), "Return KEY.",
+      [](envw, keyword_args<"key"> kws) { return kws.get<"key">(); });
+
+    THEN("the keywords are parsed from the rest arguments") {
+      REQUIRE_THAT(fun(":key", 1), LispEquals(1));
+      REQUIRE_FALSE(fun());
+    }
+  }
+}
+#endif
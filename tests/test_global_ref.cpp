@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 Eutro <https://eutro.dev>
+ *
+ * This file is part of cppemacs.
+ *
+ * cppemacs is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cppemacs is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cppemacs. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: 2024 Eutro <https://eutro.dev>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+#include "common.hpp"
+#include <thread>
+
+SCOPED_SCENARIO("owning global references") {
+  GIVEN("a global_ref to a user_ptr") {
+    std::shared_ptr<int> sptr(new int{0});
+    global_ref ref;
+    envp.run_scoped([&](envw env) {
+      ref = global_ref(env, env->*make_user_ptr<decltype(sptr)>(sptr));
+    });
+    REQUIRE(ref);
+
+    THEN("it outlives the scope it was created in") {
+      REQUIRE(cell(envp, ref).extract<user_ptr<decltype(sptr)>>()->get() == sptr.get());
+    }
+
+    WHEN("it is moved") {
+      global_ref moved = std::move(ref);
+      THEN("the reference is transferred") {
+        REQUIRE_FALSE(ref);
+        REQUIRE(moved);
+      }
+    }
+
+    WHEN("it is destroyed and the graveyard is collected") {
+      long old_count = sptr.use_count();
+      ref = global_ref();
+      global_ref::collect(envp);
+
+      if ((envp->*"garbage-collect")()) {
+        THEN("the value can be garbage collected") {
+          REQUIRE(sptr.use_count() < old_count);
+        }
+      }
+    }
+  }
+
+  GIVEN("global_refs owned by other threads") {
+    std::vector<global_ref> refs;
+    for (int i = 0; i < 64; ++i) refs.emplace_back(envp, envp->*i);
+
+    WHEN("they are destroyed concurrently, and a module function is called") {
+      std::thread t1([&]() { for (int i = 0; i < 32; ++i) refs[i] = global_ref(); });
+      std::thread t2([&]() { for (int i = 32; i < 64; ++i) refs[i] = global_ref(); });
+      t1.join();
+      t2.join();
+      cell fun = envp->*make_spreader_function(
+        spreader_thunk(), "Return nil.", [](envw) { return nullptr; });
+
+      THEN("they are freed safely") {
+        REQUIRE_FALSE(detail::global_ref_graveyard::get().empty());
+        REQUIRE_FALSE(envp.is_not_nil(fun()));
+        REQUIRE_FALSE(envp.non_local_exit_check());
+        REQUIRE(detail::global_ref_graveyard::get().empty());
+      }
+    }
+  }
+
+  GIVEN("a global_cell") {
+    global_cell fun(envp->*"list");
+
+    THEN("it can be used as a cell in an environment") {
+      REQUIRE_THAT(fun.in(envp)(1, 2), LispEquals((envp->*"list")(1, 2)));
+    }
+  }
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2024 Eutro <https://eutro.dev>
+ *
+ * This file is part of cppemacs.
+ *
+ * cppemacs is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * cppemacs is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with cppemacs. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-FileCopyrightText: 2024 Eutro <https://eutro.dev>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+
+#include "common.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cppemacs/threads.hpp>
+
+SCOPED_SCENARIO("background finalization") {
+  struct expensive {
+    std::thread::id *destroyed_on;
+    ~expensive() { *destroyed_on = std::this_thread::get_id(); }
+  };
+  using bg_ptr = user_ptr<expensive, background_delete<expensive>>;
+
+  GIVEN("a user_ptr with background_delete") {
+    std::thread::id destroyed_on;
+    cell ptr = envp->*bg_ptr(new expensive{&destroyed_on});
+    envp.maybe_non_local_exit();
+
+    WHEN("it is finalized and the reclaimer is flushed") {
+      // take ownership back from Emacs first, so the GC won't finalize it again
+      expensive *raw = ptr.extract<bg_ptr>().get();
+      envp.set_user_finalizer(ptr, nullptr);
+      envp.maybe_non_local_exit();
+      bg_ptr::fin(raw);
+      background_reclaimer::instance().flush();
+
+      THEN("it was destroyed on another thread") {
+        REQUIRE(destroyed_on != std::thread::id());
+        REQUIRE(destroyed_on != std::this_thread::get_id());
+        REQUIRE(background_reclaimer::instance().pending() == 0);
+      }
+    }
+  }
+
+  GIVEN("a full reclaimer queue") {
+    background_reclaimer::instance().set_capacity(0);
+    // restore the capacity even if a requirement fails
+    struct capacity_guard {
+      ~capacity_guard() { background_reclaimer::instance().set_capacity(background_reclaimer::default_capacity); }
+    } guard;
+    std::thread::id destroyed_on;
+
+    WHEN("an object is finalized") {
+      background_delete<expensive>()(new expensive{&destroyed_on});
+
+      THEN("it is destroyed immediately") {
+        REQUIRE(destroyed_on == std::this_thread::get_id());
+      }
+    }
+  }
+}
+
+SCOPED_SCENARIO("multi-producer queues") {
+  GIVEN("an mpsc_queue") {
+    mpsc_queue<int> queue;
+
+    WHEN("several threads push to it") {
+      std::atomic<int> wakeups(0);
+      std::vector<std::thread> producers;
+      for (int tt = 0; tt < 4; ++tt) {
+        producers.emplace_back([&queue, &wakeups, tt]() {
+          for (int ii = 0; ii < 1000; ++ii) {
+            if (queue.push(tt * 1000 + ii)) ++wakeups;
+          }
+        });
+      }
+      for (std::thread &producer : producers) producer.join();
+
+      THEN("only the first push reports an empty queue") {
+        REQUIRE(wakeups == 1);
+      }
+
+      THEN("draining gives every item, in order for each producer") {
+        std::vector<int> items;
+        REQUIRE(queue.drain([&](int item) { items.push_back(item); }) == 4000);
+        REQUIRE(queue.empty());
+        std::vector<int> last(4, -1);
+        for (int item : items) {
+          REQUIRE(item > last[item / 1000]);
+          last[item / 1000] = item;
+        }
+      }
+    }
+  }
+}
+
+SCOPED_SCENARIO("parallel transforms") {
+  GIVEN("a thread pool") {
+    thread_pool pool(4);
+
+    WHEN("a list is transformed") {
+      cell input = (envp->*"number-sequence")(1, 1000);
+      cell output = envp->*parallel_transform<intmax_t>(
+        envp, input, [](intmax_t x) { return x * x; }, pool);
+
+      THEN("the results are returned in a vector, in order") {
+        REQUIRE((envp->*"vectorp")(output));
+        REQUIRE_THAT((envp->*"length")(output), LispEquals(1000));
+        for (intmax_t ii = 0; ii < 1000; ++ii) {
+          REQUIRE_THAT((envp->*"aref")(output, ii), LispEquals((ii + 1) * (ii + 1)));
+        }
+      }
+    }
+
+    WHEN("booleans are transformed") {
+      cell output = envp->*parallel_transform<bool>(
+        envp, (envp->*"list")(true, false, true), [](bool x) { return !x; }, pool);
+
+      THEN("they are negated") {
+        REQUIRE_THAT(output, LispEquals((envp->*"vector")(false, true, false)));
+      }
+    }
+
+    WHEN("the function throws") {
+      THEN("the exception is rethrown on the main thread") {
+        REQUIRE_THROWS_AS(
+          parallel_transform<intmax_t>(
+            envp, (envp->*"number-sequence")(1, 100),
+            [](intmax_t x) -> intmax_t {
+              if (x == 50) throw std::domain_error("fifty");
+              return x;
+            }, pool),
+          std::domain_error);
+      }
+    }
+
+    WHEN("an element has the wrong type") {
+      THEN("extracting it signals an error") {
+        REQUIRE_THROWS((parallel_transform<intmax_t>(
+                          envp, (envp->*"list")(1, "two"_Estr),
+                          [](intmax_t x) { return x; }, pool),
+                        envp.maybe_non_local_exit()));
+      }
+    }
+  }
+}
+
+#if (EMACS_MAJOR_VERSION >= 28)
+// a job result that counts how many of it were destroyed
+struct counted_result {
+  static std::atomic<int> destroyed;
+  intmax_t n;
+  explicit counted_result(intmax_t n) : n(n) {}
+  counted_result(const counted_result &o) : n(o.n) {}
+  ~counted_result() { ++destroyed; }
+  friend value to_emacs(expected_type_t<counted_result>, envw nv, const counted_result &r) { return nv->*r.n; }
+};
+std::atomic<int> counted_result::destroyed(0);
+
+SCOPED_SCENARIO("asynchronous jobs") {
+  GIVEN("a thread pool and an async channel") {
+    thread_pool pool(2);
+    async_channel channel(envp, "cppemacs-test-async");
+    static std::vector<intmax_t> results;
+    results.clear();
+    cell callback = envp->*make_spreader_function(
+      spreader_arity<1>(), "Record RESULT.",
+      [](envw, cell_extracted<intmax_t> result) {
+        results.push_back(result.get());
+        return nullptr;
+      });
+
+    WHEN("jobs are run") {
+      for (intmax_t ii = 1; ii <= 10; ++ii) {
+        channel.run(envp, pool, callback, [ii]() { return ii * ii; });
+      }
+      for (int tries = 0; results.size() < 10 && tries < 100; ++tries) {
+        (envp->*"accept-process-output")(channel.process(), 0.05);
+        envp.maybe_non_local_exit();
+      }
+
+      THEN("their results are delivered to the callback") {
+        REQUIRE(results.size() == 10);
+        intmax_t sum = 0;
+        for (intmax_t result : results) sum += result;
+        REQUIRE(sum == 385);
+      }
+    }
+
+    WHEN("a completion is dropped before its job runs") {
+      std::atomic<bool> ran(false);
+      counted_result::destroyed = 0;
+      // the callback can't be referenced while an error is pending, so the
+      // completion is dropped without posting the job
+      envp.non_local_exit_signal(envp->*"error", (envp->*"list")("pending"_Estr));
+      REQUIRE_THROWS(channel.run(envp, pool, callback, [&ran]() {
+        ran = true;
+        return counted_result(1);
+      }));
+      envp.non_local_exit_clear();
+
+      THEN("its result is not destroyed") {
+        REQUIRE_FALSE(ran);
+        REQUIRE(counted_result::destroyed == 0);
+      }
+    }
+
+    channel.close(envp);
+  }
+}
+
+SCOPED_SCENARIO("message channels") {
+  GIVEN("a message channel") {
+    static std::vector<intmax_t> received;
+    static int batches;
+    received.clear();
+    batches = 0;
+    cell handler = envp->*make_spreader_function(
+      spreader_arity<1>(), "Record MESSAGES.",
+      [](envw nv, value messages) {
+        ++batches;
+        for (cell tail = nv->*messages; nv.is_not_nil(tail); tail = (nv->*"cdr")(tail)) {
+          received.push_back((nv->*"car")(tail).extract<intmax_t>());
+        }
+        return nullptr;
+      });
+    message_channel<intmax_t> channel(envp, handler, "cppemacs-test-messages");
+
+    WHEN("a worker sends a burst of messages") {
+      std::thread worker([&channel]() {
+        for (intmax_t ii = 0; ii < 1000; ++ii) channel.send(ii);
+      });
+      worker.join();
+      for (int tries = 0; received.size() < 1000 && tries < 100; ++tries) {
+        (envp->*"accept-process-output")(channel.process(), 0.05);
+        envp.maybe_non_local_exit();
+      }
+
+      THEN("they are delivered in order, in one batch") {
+        REQUIRE(received.size() == 1000);
+        for (intmax_t ii = 0; ii < 1000; ++ii) REQUIRE(received[ii] == ii);
+        REQUIRE(batches == 1);
+      }
+    }
+
+    WHEN("it is drained directly") {
+      channel.send(1);
+      channel.send(2);
+      THEN("the messages are converted to a list") {
+        REQUIRE_THAT(channel.drain(envp), LispEquals((envp->*"list")(1, 2)));
+        REQUIRE_FALSE(envp.is_not_nil(channel.drain(envp)));
+      }
+    }
+
+    channel.close(envp);
+  }
+}
+
+#ifdef CPPEMACS_HAVE_COROUTINES
+SCOPED_SCENARIO("asynchronous coroutines") {
+  GIVEN("a coroutine module function awaiting background jobs") {
+    thread_pool pool(2);
+    async_channel channel(envp, "cppemacs-test-coroutine");
+    static std::vector<intmax_t> results;
+    results.clear();
+    cell callback = envp->*make_spreader_function(
+      spreader_arity<1>(), "Record RESULT.",
+      [](envw, cell_extracted<intmax_t> result) {
+        results.push_back(result.get());
+        return nullptr;
+      });
+    cell fun = envp->*make_typed_function(
+      "Raise X to the fourth power in the background, then call DONE, or -1 on failure.",
+      [&pool, &channel](envw env, intmax_t x, value done) -> async_task {
+        global_ref cb(env, done);
+        intmax_t result;
+        try {
+          intmax_t squared = co_await channel.background(pool, [x]() {
+            if (x < 0) throw std::domain_error("negative");
+            return x * x;
+          });
+          result = co_await channel.background(pool, [squared]() { return squared * squared; });
+        } catch (const std::domain_error &) {
+          result = -1;
+        }
+        env.funcall(cb, {env->*result});
+      });
+
+    WHEN("it is called") {
+      REQUIRE_FALSE(fun(2, callback));
+      REQUIRE_FALSE(fun(-2, callback));
+      envp.maybe_non_local_exit();
+
+      THEN("it returns before the jobs are finished") {
+        REQUIRE(results.empty());
+      }
+
+      for (int tries = 0; results.size() < 2 && tries < 100; ++tries) {
+        (envp->*"accept-process-output")(channel.process(), 0.05);
+        envp.maybe_non_local_exit();
+      }
+
+      THEN("it is resumed on the main thread after each job") {
+        REQUIRE(results.size() == 2);
+        REQUIRE(std::find(results.begin(), results.end(), 16) != results.end());
+        REQUIRE(std::find(results.begin(), results.end(), -1) != results.end());
+      }
+    }
+
+    WHEN("a job is never awaited") {
+      bool ran = false;
+      counted_result::destroyed = 0;
+      {
+        auto unawaited = channel.background(pool, [&ran]() {
+          ran = true;
+          return counted_result(1);
+        });
+      }
+
+      THEN("it is dropped without running or destroying its result") {
+        REQUIRE_FALSE(ran);
+        REQUIRE(counted_result::destroyed == 0);
+      }
+    }
+
+    channel.close(envp);
+  }
+}
+#endif
+#endif
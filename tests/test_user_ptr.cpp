@@ -83,3 +83,166 @@ SCOPED_SCENARIO("type-checking user pointers") {
     }
   }
 }
+
+template <> struct cppemacs::user_ptr_base<Type1> { using type = CommonType; };
+template <> struct cppemacs::user_ptr_base<Type2> { using type = CommonType; };
+
+SCOPED_SCENARIO("tagged user pointers") {
+  GIVEN("two tagged user_ptr-s of types with a common base") {
+    cell ptr1 = envp->*make_tagged_user_ptr<Type1>(1);
+    cell ptr2 = envp->*make_tagged_user_ptr<Type2>(2);
+    envp.maybe_non_local_exit();
+
+    WHEN("they are extracted as their base") {
+      THEN("the results are upcast") {
+        REQUIRE(*ptr1.extract<tagged_user_ptr<CommonType>>() == CommonType(1));
+        REQUIRE(*ptr2.extract<tagged_user_ptr<CommonType>>() == CommonType(2));
+      }
+    }
+
+    WHEN("they are extracted as a sibling type") {
+      THEN("an exception is thrown") {
+        REQUIRE_THROWS(ptr1.extract<tagged_user_ptr<Type2>>());
+        REQUIRE_THROWS(ptr2.extract<tagged_user_ptr<Type1>>());
+      }
+    }
+
+    WHEN("they are extracted as untagged user_ptr-s") {
+      THEN("an exception is thrown") {
+        REQUIRE_THROWS(ptr1.extract<user_ptr<Type1>>());
+        REQUIRE_THROWS(ptr1.extract<user_ptr<CommonType>>());
+      }
+    }
+  }
+}
+
+SCOPED_SCENARIO("pooled user pointers") {
+  struct pooled_node { intmax_t value; pooled_node *parent; };
+
+  GIVEN("a pooled user_ptr") {
+    pool_stats before = pooled_delete<pooled_node>::statistics();
+    cell ptr = envp->*make_pooled_user_ptr<pooled_node>(pooled_node{42, nullptr});
+    envp.maybe_non_local_exit();
+
+    THEN("it is allocated from the pool") {
+      pool_stats after = pooled_delete<pooled_node>::statistics();
+      REQUIRE(after.allocations == before.allocations + 1);
+      REQUIRE(after.blocks_in_use == before.blocks_in_use + 1);
+      REQUIRE(after.blocks_in_use <= after.blocks_total);
+    }
+
+    WHEN("it is unwrapped") {
+      THEN("it can only be extracted as a pooled_user_ptr") {
+        REQUIRE(ptr.extract<pooled_user_ptr<pooled_node>>()->value == 42);
+        REQUIRE_THROWS(ptr.extract<user_ptr<pooled_node>>());
+      }
+    }
+
+  }
+
+  GIVEN("a pooled user_ptr only referenced from a scope that has returned") {
+    envp.run_scoped([&](envw env) {
+      env->*make_pooled_user_ptr<pooled_node>(pooled_node{0, nullptr});
+    });
+    size_t old_in_use = pooled_delete<pooled_node>::statistics().blocks_in_use;
+
+    WHEN("garbage collecting it") {
+      if ((envp->*"garbage-collect")()) {
+        THEN("it is returned to the pool") {
+          REQUIRE(pooled_delete<pooled_node>::statistics().blocks_in_use < old_in_use);
+        }
+      }
+    }
+  }
+}
+
+SCOPED_SCENARIO("shared user pointers") {
+  GIVEN("a shared_user_ptr passed to Emacs") {
+    auto sptr = make_shared_user_ptr<Type1>(1);
+    cell val = envp->*sptr;
+    envp.maybe_non_local_exit();
+
+    THEN("Emacs shares ownership of it") {
+      REQUIRE(sptr.use_count() == 2);
+    }
+
+    WHEN("it is unwrapped") {
+      auto unwrapped = val.extract<shared_user_ptr<Type1>>();
+      std::shared_ptr<Type1> shared = unwrapped;
+
+      THEN("the result is the same object") {
+        REQUIRE(unwrapped.get() == sptr.get());
+        REQUIRE(shared.get() == sptr.get());
+        REQUIRE(*shared == Type1(1));
+      }
+
+      THEN("it can only be extracted as the same type") {
+        REQUIRE_THROWS(val.extract<user_ptr<Type1>>());
+        REQUIRE_THROWS(val.extract<shared_user_ptr<Type2>>());
+      }
+    }
+
+  }
+
+  GIVEN("a shared_user_ptr only passed to Emacs in a scope that has returned") {
+    auto sptr = make_shared_user_ptr<Type1>(1);
+    envp.run_scoped([&](envw env) { env->*sptr; });
+    long old_count = sptr.use_count();
+
+    WHEN("garbage collecting it") {
+      if ((envp->*"garbage-collect")()) {
+        THEN("Emacs releases its ownership") {
+          REQUIRE(sptr.use_count() < old_count);
+        }
+      }
+    }
+  }
+}
+
+struct accounted_buffer {
+  size_t size;
+  size_t memory_size() const { return size; }
+};
+
+SCOPED_SCENARIO("native memory accounting") {
+  GIVEN("native memory accounting is installed") {
+    install_native_memory_accounting(envp, "cppemacs-test-native-memory");
+    native_memory::account &buffers = native_memory::account_of<accounted_buffer>();
+    size_t buffer_bytes_before = buffers.live_bytes, buffers_before = buffers.live_objects;
+
+    WHEN("an accounted user_ptr is passed to Emacs") {
+      envp->*make_user_ptr<accounted_buffer>(accounted_buffer{1 << 20});
+      envp.maybe_non_local_exit();
+
+      THEN("its size is counted") {
+        // only compare this type, so finalizers of unrelated objects cannot interfere
+        REQUIRE(buffers.live_bytes == buffer_bytes_before + (1 << 20));
+        REQUIRE(buffers.live_objects == buffers_before + 1);
+      }
+
+      THEN("the statistics are available to Lisp") {
+        cell stats = (envp->*"cppemacs-test-native-memory")();
+        REQUIRE_THAT((envp->*"plist-get")(stats, ":live-bytes"),
+                     LispEquals(intmax_t(native_memory::statistics().live_bytes)));
+      }
+
+    }
+
+    WHEN("garbage collecting accounted user_ptr-s") {
+      envp.run_scoped([&](envw env) {
+        env->*make_user_ptr<accounted_buffer>(accounted_buffer{1 << 10});
+      });
+      size_t old_live = native_memory::statistics().live_bytes;
+
+      if ((envp->*"garbage-collect")()) {
+        THEN("their sizes are no longer counted") {
+          REQUIRE(native_memory::statistics().live_bytes < old_live);
+        }
+
+        THEN("the count since the last collection is reset") {
+          REQUIRE(native_memory::statistics().allocated_since_gc == 0);
+        }
+      }
+    }
+  }
+}